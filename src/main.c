@@ -32,6 +32,7 @@
 #include <assert.h>
 #include <glib.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -220,9 +221,142 @@ static void init_logging(const char *log_file) {
 	}
 }
 
+// -- Startup.
+// The subsystems are set up as a small dependency graph: every phase runs
+// on its own thread as soon as the phases it depends on are done. The
+// output (gst_init, registry, mime scan) and the UPnP library come up in
+// parallel; only publishing the device, which announces the mime types as
+// SinkProtocolInfo, has to wait for both.
+enum startup_phase_id {
+	PHASE_OUTPUT,
+	PHASE_UPNP,
+	PHASE_TRANSPORT,
+	PHASE_CONTROL,
+	PHASE_PUBLISH,
+	PHASE_COUNT
+};
+#define PHASE_BIT(id) (1 << (id))
+
+struct startup_phase {
+	const char *name;
+	int (*run)(void);
+	int depends_on;      // Bitmask of PHASE_BIT()s.
+
+	pthread_t thread;
+	gint64 start_usec;   // Relative to the start of the graph.
+	gint64 end_usec;
+	int done;
+	int failed;
+};
+
+static struct upnp_device_descriptor *upnp_renderer_ = NULL;
+static struct upnp_device *device_ = NULL;
+
+static int phase_output(void) {
+	return output_init(output);
+}
+
+static int phase_upnp(void) {
+	device_ = upnp_device_init(upnp_renderer_, ip_address, listen_port);
+	return device_ != NULL ? 0 : -1;
+}
+
+static int phase_transport(void) {
+	upnp_transport_init(device_);
+	return 0;
+}
+
+static int phase_control(void) {
+	upnp_control_init(device_);  // Reads the initial output volume.
+	return 0;
+}
+
+static int phase_publish(void) {
+	return upnp_device_publish(device_);
+}
+
+static struct startup_phase startup_phases_[PHASE_COUNT] = {
+	[PHASE_OUTPUT] = { "output", phase_output, 0 },
+	[PHASE_UPNP] = { "upnp", phase_upnp, 0 },
+	[PHASE_TRANSPORT] = { "transport", phase_transport,
+			      PHASE_BIT(PHASE_UPNP) | PHASE_BIT(PHASE_OUTPUT) },
+	[PHASE_CONTROL] = { "control", phase_control,
+			    PHASE_BIT(PHASE_UPNP) | PHASE_BIT(PHASE_OUTPUT) },
+	[PHASE_PUBLISH] = { "publish", phase_publish,
+			    PHASE_BIT(PHASE_OUTPUT) | PHASE_BIT(PHASE_UPNP)
+			    | PHASE_BIT(PHASE_TRANSPORT)
+			    | PHASE_BIT(PHASE_CONTROL) },
+};
+static pthread_mutex_t startup_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startup_cond_ = PTHREAD_COND_INITIALIZER;
+static gint64 startup_begin_usec_ = 0;
+
+// Returns 1 if all dependencies are done, -1 if one of them failed, or 0
+// if we need to keep waiting. Needs startup_mutex_.
+static int dependencies_done(const struct startup_phase *phase) {
+	int result = 1;
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		if (!(phase->depends_on & PHASE_BIT(i)))
+			continue;
+		if (startup_phases_[i].failed)
+			return -1;
+		if (!startup_phases_[i].done)
+			result = 0;
+	}
+	return result;
+}
+
+static void *run_startup_phase(void *userdata) {
+	struct startup_phase *phase = (struct startup_phase*) userdata;
+	int ready;
+	pthread_mutex_lock(&startup_mutex_);
+	while ((ready = dependencies_done(phase)) == 0) {
+		pthread_cond_wait(&startup_cond_, &startup_mutex_);
+	}
+	pthread_mutex_unlock(&startup_mutex_);
+
+	const gint64 start = g_get_monotonic_time();
+	const int rc = (ready > 0) ? phase->run() : -1;
+	const gint64 end = g_get_monotonic_time();
+
+	pthread_mutex_lock(&startup_mutex_);
+	phase->start_usec = start - startup_begin_usec_;
+	phase->end_usec = end - startup_begin_usec_;
+	phase->failed = (rc != 0);
+	phase->done = 1;
+	pthread_cond_broadcast(&startup_cond_);
+	pthread_mutex_unlock(&startup_mutex_);
+
+	if (ready > 0) {
+		Log_info("main", "Startup phase '%s' %s in %.1fms "
+			 "(+%.1fms .. +%.1fms)", phase->name,
+			 rc == 0 ? "done" : "FAILED", (end - start) / 1000.0,
+			 phase->start_usec / 1000.0, phase->end_usec / 1000.0);
+	}
+	return NULL;
+}
+
+// Runs all phases; returns FALSE if any of them failed.
+static gboolean run_startup_graph(void) {
+	startup_begin_usec_ = g_get_monotonic_time();
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		pthread_create(&startup_phases_[i].thread, NULL,
+			       run_startup_phase, &startup_phases_[i]);
+	}
+	gboolean success = TRUE;
+	for (int i = 0; i < PHASE_COUNT; ++i) {
+		pthread_join(startup_phases_[i].thread, NULL);
+		if (startup_phases_[i].failed) {
+			success = FALSE;
+		}
+	}
+	Log_info("main", "Startup took %.1fms",
+		 (g_get_monotonic_time() - startup_begin_usec_) / 1000.0);
+	return success;
+}
+
 int main(int argc, char **argv)
 {
-	int rc;
 	struct upnp_device_descriptor *upnp_renderer;
 
 #if !GLIB_CHECK_VERSION(2,32,0)
@@ -278,19 +412,6 @@ int main(int argc, char **argv)
 		fclose(pid_file_stream);
 	}
 
-	upnp_renderer = upnp_renderer_descriptor(friendly_name, uuid, mime_filter);
-	if (upnp_renderer == NULL) {
-		return EXIT_FAILURE;
-	}
-
-	rc = output_init(output);
-	if (rc != 0) {
-		Log_error("main",
-			  "ERROR: Failed to initialize Output subsystem");
-		return EXIT_FAILURE;
-	}
-
-	struct upnp_device *device;
 	if (listen_port != 0 &&
 	    (listen_port < 49152 || listen_port > 65535)) {
 		// Somewhere obscure internally in libupnp, they clamp the
@@ -302,14 +423,26 @@ int main(int argc, char **argv)
 			  listen_port);
 		return EXIT_FAILURE;
 	}
-	device = upnp_device_init(upnp_renderer, ip_address, listen_port);
-	if (device == NULL) {
-		Log_error("main", "ERROR: Failed to initialize UPnP device");
+
+	upnp_renderer = upnp_renderer_descriptor(friendly_name, uuid, mime_filter);
+	if (upnp_renderer == NULL) {
 		return EXIT_FAILURE;
 	}
-
-	upnp_transport_init(device);
-	upnp_control_init(device);
+	upnp_renderer_ = upnp_renderer;
+
+	if (!run_startup_graph()) {
+		if (startup_phases_[PHASE_OUTPUT].failed) {
+			Log_error("main",
+				  "ERROR: Failed to initialize Output subsystem");
+		} else {
+			Log_error("main", "ERROR: Failed to initialize UPnP device");
+		}
+		if (device_ != NULL) {
+			upnp_device_shutdown(device_);
+		}
+		return EXIT_FAILURE;
+	}
+	struct upnp_device *device = device_;
 
 	if (show_devicedesc) {
 		// This can only be run after all services have been
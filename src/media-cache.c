@@ -0,0 +1,320 @@
+/* media-cache - Size capped disk cache for media fetched over the network.
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "media-cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include "logging.h"
+
+// Each entry is a data file named by the SHA1 of the uri, and a .meta file
+// with the uri in the first line, followed by the validators. The mtime of
+// the data file is the time it was last used.
+
+static char *cache_dir_ = NULL;
+static int64_t max_bytes_ = 0;
+static pthread_mutex_t evict_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+struct MediaCacheWriter {
+	char *uri;
+	char *part_path;
+	FILE *out;
+	char *validators;
+	int64_t expected;  // Content-Length, or -1 if unknown.
+	int64_t written;
+	int failed;
+	int finished;
+};
+
+static char *entry_path(const char *uri, const char *suffix) {
+	gchar *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, uri, -1);
+	const size_t len = strlen(cache_dir_) + strlen(key) + strlen(suffix) + 2;
+	char *path = malloc(len);
+	snprintf(path, len, "%s/%s%s", cache_dir_, key, suffix);
+	g_free(key);
+	return path;
+}
+
+// Returns newly allocated content of the file or NULL.
+static char *read_file(const char *path) {
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		return NULL;
+	}
+	size_t size = 0;
+	size_t capacity = 256;
+	char *content = malloc(capacity);
+	size_t r;
+	while ((r = fread(content + size, 1, capacity - size - 1, in)) > 0) {
+		size += r;
+		if (size + 1 == capacity) {
+			capacity *= 2;
+			content = realloc(content, capacity);
+		}
+	}
+	fclose(in);
+	content[size] = '\0';
+	return content;
+}
+
+struct entry {
+	char *name;
+	off_t size;
+	time_t last_use;
+};
+
+static int compare_last_use(const void *a, const void *b) {
+	const struct entry *ea = (const struct entry *) a;
+	const struct entry *eb = (const struct entry *) b;
+	return (ea->last_use > eb->last_use) - (ea->last_use < eb->last_use);
+}
+
+// Remove least recently used entries until we fit in max_bytes_.
+static void evict(void) {
+	pthread_mutex_lock(&evict_mutex_);
+	DIR *dir = opendir(cache_dir_);
+	if (dir == NULL) {
+		pthread_mutex_unlock(&evict_mutex_);
+		return;
+	}
+	int count = 0;
+	int capacity = 64;
+	struct entry *entries = malloc(capacity * sizeof(*entries));
+	int64_t total = 0;
+	const struct dirent *d;
+	while ((d = readdir(dir)) != NULL) {
+		if (strchr(d->d_name, '.') != NULL) {
+			continue;  // '.', '..', meta and partial files.
+		}
+		char *path = malloc(strlen(cache_dir_) + strlen(d->d_name) + 2);
+		sprintf(path, "%s/%s", cache_dir_, d->d_name);
+		struct stat st;
+		if (stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			if (count == capacity) {
+				capacity *= 2;
+				entries = realloc(entries,
+						  capacity * sizeof(*entries));
+			}
+			entries[count].name = path;
+			entries[count].size = st.st_size;
+			entries[count].last_use = st.st_mtime;
+			total += st.st_size;
+			++count;
+		} else {
+			free(path);
+		}
+	}
+	closedir(dir);
+
+	qsort(entries, count, sizeof(*entries), compare_last_use);
+	for (int i = 0; i < count; ++i) {
+		if (total > max_bytes_) {
+			char *meta = malloc(strlen(entries[i].name) + 6);
+			sprintf(meta, "%s.meta", entries[i].name);
+			unlink(meta);
+			unlink(entries[i].name);
+			free(meta);
+			total -= entries[i].size;
+		}
+		free(entries[i].name);
+	}
+	free(entries);
+	pthread_mutex_unlock(&evict_mutex_);
+}
+
+int MediaCache_init(const char *dir, int64_t max_bytes) {
+	if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		Log_error("cache", "Can't create cache directory %s: %s",
+			  dir, strerror(errno));
+		return -1;
+	}
+	cache_dir_ = strdup(dir);
+	max_bytes_ = max_bytes;
+	evict();  // Limit might have changed.
+	Log_info("cache", "Caching up to %" PRId64 "MB in %s",
+		 max_bytes / 1000000, dir);
+	return 0;
+}
+
+int MediaCache_enabled(void) {
+	return cache_dir_ != NULL && max_bytes_ > 0;
+}
+
+char *MediaCache_lookup(const char *uri, char **validators) {
+	if (!MediaCache_enabled() || uri == NULL) {
+		return NULL;
+	}
+	char *data_path = entry_path(uri, "");
+	char *meta_path = entry_path(uri, ".meta");
+	char *meta = read_file(meta_path);
+	free(meta_path);
+
+	char *newline = meta ? strchr(meta, '\n') : NULL;
+	struct stat st;
+	if (newline == NULL || stat(data_path, &st) != 0
+	    || strncmp(meta, uri, newline - meta) != 0
+	    || strlen(uri) != (size_t) (newline - meta)) {
+		free(meta);
+		free(data_path);
+		return NULL;
+	}
+	utime(data_path, NULL);  // Recently used.
+	if (validators != NULL) {
+		*validators = strdup(newline + 1);
+	}
+	free(meta);
+	return data_path;
+}
+
+void MediaCache_invalidate(const char *uri) {
+	if (!MediaCache_enabled() || uri == NULL) {
+		return;
+	}
+	char *data_path = entry_path(uri, "");
+	char *meta_path = entry_path(uri, ".meta");
+	unlink(meta_path);
+	unlink(data_path);
+	free(meta_path);
+	free(data_path);
+}
+
+struct MediaCacheWriter *MediaCache_begin(const char *uri) {
+	if (!MediaCache_enabled() || uri == NULL) {
+		return NULL;
+	}
+	struct MediaCacheWriter *writer = calloc(1, sizeof(*writer));
+	writer->uri = strdup(uri);
+	// There might be more than one download of the same uri.
+	writer->part_path = entry_path(uri, ".part-XXXXXX");
+	int fd = mkstemp(writer->part_path);
+	writer->out = (fd >= 0) ? fdopen(fd, "w") : NULL;
+	writer->failed = (writer->out == NULL);
+	writer->expected = -1;
+	return writer;
+}
+
+void MediaCache_set_validators(struct MediaCacheWriter *writer,
+			       const char *validators) {
+	if (writer == NULL) {
+		return;
+	}
+	free(writer->validators);
+	writer->validators = validators ? strdup(validators) : NULL;
+	const char *length = validators
+		? strstr(validators, "Content-Length: ") : NULL;
+	writer->expected = -1;
+	if (length != NULL) {
+		char *end = NULL;
+		length += strlen("Content-Length: ");
+		const long long value = strtoll(length, &end, 10);
+		if (end != length && value >= 0) {
+			writer->expected = value;
+		}
+	}
+}
+
+void MediaCache_append(struct MediaCacheWriter *writer,
+		       const void *data, size_t len, int64_t offset) {
+	if (writer == NULL || writer->failed || writer->finished) {
+		return;
+	}
+	if (offset >= 0 && offset != writer->written) {
+		// Seeked; we'd only have parts of the stream.
+		writer->failed = 1;
+		return;
+	}
+	if (writer->written + (int64_t) len > max_bytes_
+	    || fwrite(data, 1, len, writer->out) != len) {
+		writer->failed = 1;
+		return;
+	}
+	writer->written += len;
+}
+
+void MediaCache_finish(struct MediaCacheWriter *writer) {
+	if (writer == NULL || writer->failed || writer->finished) {
+		return;
+	}
+	if (fclose(writer->out) != 0) {
+		writer->out = NULL;
+		writer->failed = 1;
+		return;
+	}
+	writer->out = NULL;
+	if (writer->expected >= 0 && writer->written != writer->expected) {
+		// Connection dropped; end of stream doesn't mean we have it all.
+		Log_error("cache", "Got %" PRId64 " of %" PRId64 " bytes of %s; "
+			  "not caching.", writer->written, writer->expected,
+			  writer->uri);
+		writer->failed = 1;
+		return;
+	}
+
+	char *data_path = entry_path(writer->uri, "");
+	char *meta_path = entry_path(writer->uri, ".meta");
+	FILE *meta = fopen(meta_path, "w");
+	if (meta != NULL) {
+		fprintf(meta, "%s\n%s", writer->uri,
+			writer->validators ? writer->validators : "");
+		if (fclose(meta) == 0
+		    && rename(writer->part_path, data_path) == 0) {
+			writer->finished = 1;
+			Log_info("cache", "Cached %" PRId64 " bytes of %s",
+				 writer->written, writer->uri);
+		}
+	}
+	free(meta_path);
+	free(data_path);
+	if (writer->finished) {
+		evict();
+	}
+}
+
+void MediaCache_close(struct MediaCacheWriter *writer) {
+	if (writer == NULL) {
+		return;
+	}
+	if (writer->out != NULL) {
+		fclose(writer->out);
+	}
+	if (!writer->finished) {
+		unlink(writer->part_path);
+	}
+	free(writer->uri);
+	free(writer->part_path);
+	free(writer->validators);
+	free(writer);
+}
@@ -0,0 +1,62 @@
+/* media-cache - Size capped disk cache for media fetched over the network.
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+#ifndef _MEDIA_CACHE_H
+#define _MEDIA_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Entries are keyed by uri; each remembers the validators (ETag,
+// Last-Modified, Content-Length) it was fetched with. When full, the least
+// recently used entries are removed.
+
+// Use the given directory (created if needed), holding at most max_bytes.
+// Returns 0 on success.
+int MediaCache_init(const char *dir, int64_t max_bytes);
+
+// Returns 1 if the cache is usable.
+int MediaCache_enabled(void);
+
+// Returns newly allocated path of the cached file for the uri or NULL.
+// If "validators" is not NULL, it receives a newly allocated string with
+// the validators stored with the entry. Marks the entry as recently used.
+char *MediaCache_lookup(const char *uri, char **validators);
+
+// Remove the entry of the uri, e.g. because it is out of date.
+void MediaCache_invalidate(const char *uri);
+
+// Writing a new entry. The data needs to be appended from the start of the
+// stream without gap; everything else abandons the entry.
+struct MediaCacheWriter;
+struct MediaCacheWriter *MediaCache_begin(const char *uri);
+void MediaCache_set_validators(struct MediaCacheWriter *writer,
+			       const char *validators);
+// offset is the position of the data in the stream, or -1 if unknown.
+void MediaCache_append(struct MediaCacheWriter *writer,
+		       const void *data, size_t len, int64_t offset);
+// Complete stream has been written; make it available. If the validators
+// have a Content-Length that doesn't match, the entry is abandoned.
+void MediaCache_finish(struct MediaCacheWriter *writer);
+// Release the writer; discards the entry if it was not finished.
+void MediaCache_close(struct MediaCacheWriter *writer);
+
+#endif  // _MEDIA_CACHE_H
@@ -37,19 +37,20 @@
 
 #include "logging.h"
 #include "output_module.h"
+#include "output_sim.h"
 #ifdef HAVE_GST
 #include "output_gstreamer.h"
+#include "output_pcm.h"
 #endif
 #include "output.h"
 
 static struct output_module *modules[] = {
 #ifdef HAVE_GST
 	&gstreamer_output,
-#else
-	// this will be a runtime error, but there is not much point
-	// in waiting till then.
-#error "No output configured. You need to ./configure --with-gstreamer"
+	&pcm_output,
 #endif
+	// Doesn't need GStreamer; the only one without it.
+	&sim_output,
 };
 
 static struct output_module *output_module = NULL;
@@ -165,6 +166,14 @@ int output_play(output_transition_cb_t transition_callback) {
 	return -1;
 }
 
+int output_play_at(gint64 clock_time,
+		   output_transition_cb_t transition_callback) {
+	if (output_module && output_module->play_at) {
+		return output_module->play_at(clock_time, transition_callback);
+	}
+	return -1;
+}
+
 int output_pause(void) {
 	if (output_module && output_module->pause) {
 		return output_module->pause();
@@ -186,6 +195,20 @@ int output_seek(gint64 position_nanos) {
 	return -1;
 }
 
+int output_seek_bytes(gint64 position_bytes) {
+	if (output_module && output_module->seek_bytes) {
+		return output_module->seek_bytes(position_bytes);
+	}
+	return -1;
+}
+
+int output_set_rate(double rate) {
+	if (output_module && output_module->set_rate) {
+		return output_module->set_rate(rate);
+	}
+	return -1;
+}
+
 int output_get_position(gint64 *track_dur, gint64 *track_pos) {
 	if (output_module && output_module->get_position) {
 		return output_module->get_position(track_dur, track_pos);
@@ -193,6 +216,13 @@ int output_get_position(gint64 *track_dur, gint64 *track_pos) {
 	return -1;
 }
 
+int output_get_stream_bitrate(guint *bitrate) {
+	if (output_module && output_module->get_stream_bitrate) {
+		return output_module->get_stream_bitrate(bitrate);
+	}
+	return -1;
+}
+
 int output_get_volume(float *value) {
 	if (output_module && output_module->get_volume) {
 		return output_module->get_volume(value);
@@ -32,6 +32,13 @@
 enum PlayFeedback {
 	PLAY_STOPPED,
 	PLAY_STARTED_NEXT_STREAM,
+	// A play or seek command, that returned right away, actually
+	// completed now (the output reached the requested state).
+	PLAY_TRANSITION_DONE,
+	// While playing, the stream ran out of data; playback waits until
+	// enough is buffered again, which is reported with PLAY_BUFFERED.
+	PLAY_BUFFERING,
+	PLAY_BUFFERED,
 };
 typedef void (*output_transition_cb_t)(enum PlayFeedback);
 
@@ -49,10 +56,15 @@ void output_set_uri(const char *uri, output_update_meta_cb_t meta_info);
 void output_set_next_uri(const char *uri);
 
 int output_play(output_transition_cb_t done_callback);
+// Start playing once the shared network clock reaches clock_time (nanos).
+int output_play_at(gint64 clock_time, output_transition_cb_t done_callback);
 int output_stop(void);
 int output_pause(void);
 int output_get_position(gint64 *track_dur_nanos, gint64 *track_pos_nanos);
+int output_get_stream_bitrate(guint *bitrate);
 int output_seek(gint64 position_nanos);
+int output_seek_bytes(gint64 position_bytes);
+int output_set_rate(double rate);
 
 int output_get_volume(float *v);
 int output_set_volume(float v);
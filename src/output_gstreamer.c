@@ -28,21 +28,137 @@
 #include "config.h"
 #endif
 
+#include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
 #include <gst/gst.h>
+#ifdef HAVE_GST_NET
+#include <gst/net/net.h>
+#endif
 #include <math.h>
+#include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 #include <inttypes.h>
+#include <pthread.h>
 
 #include "logging.h"
+#include "media-cache.h"
 #include "upnp_connmgr.h"
 #include "output_module.h"
 #include "output_gstreamer.h"
 
 static double buffer_duration = 0.0; /* Buffer disbled by default, see #182 */
+static gint buffer_low_percent = 10;   /* --gstout-buffer-low-percent */
+static gint buffer_high_percent = 100; /* --gstout-buffer-high-percent */
+static gboolean buffer_adaptive = FALSE;  /* --gstout-buffer-adaptive */
+static double buffer_min_seconds = 1.0;   /* --gstout-buffer-min-seconds */
+static double buffer_max_seconds = 10.0;  /* --gstout-buffer-max-seconds */
+static double buffer_max_mb = 8.0;        /* --gstout-buffer-max-mb */
+static gint adaptive_min_kbps = 0;        /* --gstout-adaptive-min-kbps */
+static gint adaptive_max_kbps = 0;        /* --gstout-adaptive-max-kbps */
+static double prefetch_mb = 0.0;     /* --gstout-prefetch-mb */
+static double predecode_seconds = 0.0;  /* --gstout-predecode-seconds */
+static double crossfade_seconds = 0.0;  /* --gstout-crossfade-seconds */
+static double timeshift_mb = 0.0;       /* --gstout-timeshift-mb */
+static gint rtp_latency_ms = -1;        /* --gstout-rtp-latency-ms */
+static gchar *net_clock = NULL;         /* --gstout-net-clock */
+static gint clock_provider_port = 0;    /* --gstout-clock-provider-port */
+static gint sync_latency_ms = 300;      /* --gstout-sync-latency-ms */
+
+// Extra flags for seeking, chosen with --gstout-seek-strategy.
+static GstSeekFlags seek_flags_ = GST_SEEK_FLAG_NONE;
+
+// The scan below walks the pad templates of every element, which takes
+// a while with a full set of plugins. So we keep the result in a file
+// (--gstout-mime-cache), valid as long as the same plugins are installed.
+static gchar *mime_cache = NULL;
+
+static gint compare_strings(gconstpointer a, gconstpointer b) {
+	return strcmp(*(const char * const *) a, *(const char * const *) b);
+}
+
+// Fingerprint of the installed plugins: name, file, mtime and size.
+static gchar *registry_fingerprint(GstRegistry *registry) {
+	GPtrArray *entries = g_ptr_array_new_with_free_func(g_free);
+	GList *plugins = gst_registry_get_plugin_list(registry);
+	for (GList *it = plugins; it != NULL; it = g_list_next(it)) {
+		GstPlugin *plugin = GST_PLUGIN(it->data);
+		const gchar *filename = gst_plugin_get_filename(plugin);
+		struct stat st;
+		if (filename == NULL || stat(filename, &st) != 0) {
+			st.st_mtime = 0;
+			st.st_size = 0;
+		}
+		g_ptr_array_add(entries, g_strdup_printf(
+			"%s:%s:%ld:%ld", gst_plugin_get_name(plugin),
+			filename ? filename : "", (long) st.st_mtime,
+			(long) st.st_size));
+	}
+	gst_plugin_list_free(plugins);
+	g_ptr_array_sort(entries, compare_strings);
+	g_ptr_array_add(entries, g_strdup_printf("gstreamer-%d.%d",
+						 GST_VERSION_MAJOR,
+						 GST_VERSION_MINOR));
+	g_ptr_array_add(entries, NULL);
+	gchar *all = g_strjoinv("\n", (gchar **) entries->pdata);
+	gchar *fingerprint = g_compute_checksum_for_string(G_CHECKSUM_SHA1,
+							   all, -1);
+	g_free(all);
+	g_ptr_array_free(entries, TRUE);
+	return fingerprint;
+}
+
+// Registers the cached mime types, if the cache is for this fingerprint.
+static int load_mime_cache(const char *fingerprint) {
+	gchar *content = NULL;
+	if (!g_file_get_contents(mime_cache, &content, NULL, NULL)) {
+		return 0;
+	}
+	gchar **lines = g_strsplit(content, "\n", -1);
+	g_free(content);
+	const int valid = (lines[0] != NULL
+			   && strcmp(lines[0], fingerprint) == 0);
+	int count = 0;
+	for (int i = 1; valid && lines[i] != NULL; ++i) {
+		if (lines[i][0] != '\0') {
+			register_mime_type(lines[i]);
+			++count;
+		}
+	}
+	g_strfreev(lines);
+	if (valid) {
+		Log_info("gstreamer", "%d mime types from %s", count,
+			 mime_cache);
+	}
+	return valid;
+}
+
+static void save_mime_cache(const char *fingerprint, GHashTable *types) {
+	gchar *dir = g_path_get_dirname(mime_cache);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+	GString *content = g_string_new(fingerprint);
+	GHashTableIter it;
+	gpointer type;
+	g_hash_table_iter_init(&it, types);
+	while (g_hash_table_iter_next(&it, &type, NULL)) {
+		g_string_append_printf(content, "\n%s", (const char *) type);
+	}
+	GError *error = NULL;
+	if (!g_file_set_contents(mime_cache, content->str, content->len,
+				 &error)) {
+		Log_error("gstreamer", "Can't write mime cache: %s",
+			  error->message);
+		g_error_free(error);
+	}
+	g_string_free(content, TRUE);
+}
 
 static void scan_mime_list(void)
 {
@@ -54,6 +170,20 @@ static void scan_mime_list(void)
 	registry = gst_registry_get();
 #endif
 
+	const gint64 start_usec = g_get_monotonic_time();
+	gchar *fingerprint = NULL;
+	if (mime_cache != NULL && mime_cache[0] != '\0') {
+		fingerprint = registry_fingerprint(registry);
+		if (load_mime_cache(fingerprint)) {
+			g_free(fingerprint);
+			register_mime_type("audio/*");
+			return;
+		}
+	}
+	// Distinct mime types we found, for the cache.
+	GHashTable *types = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, NULL);
+
 	// Fetch a list of all element factories
 	GList* features =
 		gst_registry_get_feature_list(registry, GST_TYPE_ELEMENT_FACTORY);
@@ -104,8 +234,13 @@ static void scan_mime_list(void)
 
 			for (guint i = 0; i < gst_caps_get_size(capabilities); i++) {
 				GstStructure* structure = gst_caps_get_structure(capabilities, i);
+				const gchar *name = gst_structure_get_name(structure);
 
-				register_mime_type(gst_structure_get_name(structure));
+				if (g_hash_table_lookup(types, name) == NULL) {
+					g_hash_table_insert(types, g_strdup(name),
+							    GINT_TO_POINTER(1));
+					register_mime_type(name);
+				}
 			}
 
 			gst_caps_unref(capabilities);
@@ -115,6 +250,15 @@ static void scan_mime_list(void)
 	// Free any allocated memory
 	gst_plugin_feature_list_free(root);
 
+	Log_info("gstreamer", "Scanned %u mime types in %" PRId64 "ms",
+		 g_hash_table_size(types),
+		 (g_get_monotonic_time() - start_usec) / 1000);
+	if (fingerprint != NULL) {
+		save_mime_cache(fingerprint, types);
+		g_free(fingerprint);
+	}
+	g_hash_table_destroy(types);
+
 	// There seem to be all kinds of mime types out there that start with
 	// "audio/" but are not explicitly supported by gstreamer. Let's just
 	// tell the controller that we can handle everything "audio/*" and hope
@@ -122,11 +266,92 @@ static void scan_mime_list(void)
 	register_mime_type("audio/*");
 }
 
-static GstElement *player_ = NULL;
+void output_gstreamer_register_mime_types(void) {
+	if (mime_cache == NULL) {
+		mime_cache = g_build_filename(g_get_user_cache_dir(),
+					      "gmediarender", "mime-types",
+					      NULL);
+	}
+	scan_mime_list();
+}
+
+// RTP streams come via rtsp://, or as rtp:// (rtpsrc, which has a
+// jitterbuffer of its own). Only rtsp has its own protocol info; rtp://
+// uris usually are announced through it. Plain udp:// has no caps nor
+// depayloader for playbin to make sense of raw RTP, so it isn't covered.
+static void register_rtp_protocols(void)
+{
+	if (gst_uri_protocol_is_supported(GST_URI_SRC, "rtsp")) {
+		register_protocol_info("rtsp-rtp-udp:*:*:*");
+	} else {
+		Log_error("gstreamer", "No element to receive rtsp:// streams.");
+	}
+	if (!gst_uri_protocol_is_supported(GST_URI_SRC, "rtp")) {
+		Log_error("gstreamer", "No element to receive rtp:// streams.");
+	}
+}
+
+// Pool of pipelines (--gstout-pipelines). We play with the active one, the
+// others preroll upcoming uris so that switching to them is instant.
+// Crossfade envelope in stream time (nanoseconds); -1 if not fading.
+struct fade {
+	gint64 in_end;
+	gint64 out_start;
+	gint64 out_end;
+};
+static const struct fade kNoFade = { -1, -1, -1 };
+
+#define MAX_PIPELINES 4
+struct pipeline {
+	GstElement *player;
+	guint bus_watch;
+	char *loaded_uri;   // uri playbin currently has; strdup()ed
+
+	// The queue2 buffering the stream and, for HLS/DASH, the adaptive
+	// demuxer; ref'ed, protected by buffer_mutex_. The bitrate of the
+	// stream, or of the variant playing; 0 if unknown.
+	GstElement *queue;
+	GstElement *demux;
+	guint bitrate;
+
+	// Crossfade envelope; protected by fade_mutex_.
+	struct fade fade;
+
+	// Tags posted while prerolling as an idle pipeline; NULL if none.
+	GstTagList *tags;
+};
+static struct pipeline pipelines_[MAX_PIPELINES];
+static struct pipeline *active_ = &pipelines_[0];
+static gint pipeline_count = 1;
+
+// The fader applies the envelope in the streaming thread, while the main
+// loop sets it.
+static pthread_mutex_t fade_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+static void set_fade(struct pipeline *p, struct fade fade) {
+	pthread_mutex_lock(&fade_mutex_);
+	p->fade = fade;
+	pthread_mutex_unlock(&fade_mutex_);
+}
+
+// Pipeline that still plays out the end of the previous track while
+// crossfading.
+static struct pipeline *fading_out_ = NULL;
+
+static GstElement *player_ = NULL;  // playbin of active_
+static float volume_ = 1.0;         // Until the pipelines are built.
+static int mute_ = 0;
 static char *gsuri_ = NULL;         // locally strdup()ed
 static char *gs_next_uri_ = NULL;   // locally strdup()ed
 static struct SongMetaData song_meta_;
 
+// State we want the pipeline to be in once it is done buffering.
+static GstState target_state_ = GST_STATE_READY;
+
+// With --gstout-preroll, SetAVTransportURI already takes the pipeline to
+// PAUSED, so that Play only needs to flip it to PLAYING.
+static gboolean preroll_on_set_uri = FALSE;
+
 static output_transition_cb_t play_trans_callback_ = NULL;
 static output_update_meta_cb_t meta_update_callback_ = NULL;
 
@@ -136,17 +361,1318 @@ struct track_time_info {
 };
 static struct track_time_info last_known_time_ = {0, 0};
 
-static GstState get_current_player_state() {
+// Set while a play or seek command is still on its way in the pipeline;
+// cleared once we told the transport that it is done.
+static int transition_pending_ = 0;
+// Waiting for the buffer to fill up to the high watermark. If that happened
+// while playing, the transport has been told with PLAY_BUFFERING.
+static int buffering_ = 0;
+static int underrun_reported_ = 0;
+static gint64 buffering_since_usec_ = 0;
+
+// Latest seek request. Protected by seek_mutex_.
+static pthread_mutex_t seek_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	GstFormat format;
+	gint64 position;
+	int in_flight;     // flushing seek issued, no ASYNC_DONE yet.
+	int queued;        // another request came in while in flight.
+	int coalesced;     // number of requests that were never issued.
+	gint64 issued_usec;
+} seek_ = { GST_FORMAT_TIME, 0, 0, 0, 0, 0 };
+
+// Don't wait forever for a seek to finish, we might never get an ASYNC_DONE.
+static const gint64 kMaxSeekInFlightUsec = 2000000;
+
+// Playback rate as requested with TransportPlaySpeed. It needs a prerolled
+// pipeline to be set, so might be pending until then.
+static double playback_rate_ = 1.0;
+static int rate_change_pending_ = 0;
+
+// The next stream has been queued in playbin, but is not audible yet. We
+// only tell the transport once it actually starts (STREAM_START).
+static int next_stream_pending_ = 0;
+static gint64 next_stream_queued_usec_ = 0;  // g_get_monotonic_time()
+// Tags of the next stream posted before it started; they must not show up
+// as those of the track still playing.
+static GstTagList *next_stream_tags_ = NULL;
+
+// Merges the tags into the list in *slot; takes ownership of them.
+static void keep_tags(GstTagList **slot, GstTagList *tags) {
+	if (*slot == NULL) {
+		*slot = tags;
+	} else {
+		gst_tag_list_insert(*slot, tags, GST_TAG_MERGE_REPLACE);
+		gst_tag_list_free(tags);
+	}
+}
+
+static void forget_tags(GstTagList **slot) {
+	if (*slot != NULL) {
+		gst_tag_list_free(*slot);
+		*slot = NULL;
+	}
+}
+
+// The pipelines are only built when there is something to play, so that
+// an idle renderer does not hold on to the audio device. With
+// --gstout-idle-seconds, they are released again after a stop or the end of
+// the stream. Commands come from the UPnP threads, while the release
+// happens in the main loop; players_mutex_ keeps them apart.
+static pthread_mutex_t players_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static int players_released_ = 0;      // In NULL state after idling.
+static void ensure_players(void);      // Needs players_mutex_.
+static void arm_idle_timer(void);      // Needs players_mutex_.
+
+static GstState get_player_state(GstElement *player) {
+	if (player == NULL) {
+		return GST_STATE_NULL;  // Not built (yet).
+	}
 	GstState state = GST_STATE_PLAYING;
 	GstState pending = GST_STATE_NULL;
-	gst_element_get_state(player_, &state, &pending, 0);
+	gst_element_get_state(player, &state, &pending, 0);
 	return state;
 }
 
+static GstState get_current_player_state() {
+	return get_player_state(player_);
+}
+
+static int is_http(const char *uri) {
+	return (uri != NULL && (g_str_has_prefix(uri, "http://")
+				|| g_str_has_prefix(uri, "https://")));
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Media cache (--gstout-cache-dir). Whatever the http source of playbin
+// fetches is written to the cache, and when we play that uri again, playbin
+// gets the cached file instead. That file is checked against the server
+// in the background; if it changed, we still play the cached copy this
+// time, but remove it from the cache.
+
+struct validators {
+	const char *etag;
+	const char *last_modified;
+	const char *content_length;
+};
+
+static gboolean collect_validator(GQuark field, const GValue *value,
+				  gpointer userdata) {
+	struct validators *v = (struct validators *) userdata;
+	if (!G_VALUE_HOLDS_STRING(value)) {
+		return TRUE;
+	}
+	const char *name = g_quark_to_string(field);
+	if (g_ascii_strcasecmp(name, "ETag") == 0) {
+		v->etag = g_value_get_string(value);
+	} else if (g_ascii_strcasecmp(name, "Last-Modified") == 0) {
+		v->last_modified = g_value_get_string(value);
+	} else if (g_ascii_strcasecmp(name, "Content-Length") == 0) {
+		v->content_length = g_value_get_string(value);
+	}
+	return TRUE;
+}
+
+// Returns the validators found in the "http-headers" structure of
+// souphttpsrc as newly allocated string.
+static gchar *get_validators(const GstStructure *http_headers) {
+	struct validators v = { NULL, NULL, NULL };
+	GstStructure *response = NULL;
+	if (gst_structure_get(http_headers, "response-headers",
+			      GST_TYPE_STRUCTURE, &response, NULL)) {
+		gst_structure_foreach(response, collect_validator, &v);
+	}
+	gchar *result = g_strdup_printf(
+		"ETag: %s\nLast-Modified: %s\nContent-Length: %s\n",
+		v.etag ? v.etag : "",
+		v.last_modified ? v.last_modified : "",
+		v.content_length ? v.content_length : "");
+	if (response != NULL) {
+		gst_structure_free(response);
+	}
+	return result;
+}
+
+struct revalidation {
+	GstElement *pipeline;
+	char *uri;
+	char *validators;
+};
+
+static gboolean revalidate_bus_callback(GstBus *bus, GstMessage *msg,
+					gpointer userdata) {
+	(void)bus;
+	struct revalidation *r = (struct revalidation *) userdata;
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ELEMENT: {
+		const GstStructure *s = gst_message_get_structure(msg);
+		if (s == NULL || !gst_structure_has_name(s, "http-headers")) {
+			return TRUE;
+		}
+		gchar *current = get_validators(s);
+		if (strcmp(current, r->validators) != 0) {
+			Log_info("gstreamer", "'%s' changed on the server; "
+				 "removing it from the cache.", r->uri);
+			MediaCache_invalidate(r->uri);
+		}
+		g_free(current);
+		break;
+	}
+	case GST_MESSAGE_ERROR:
+	case GST_MESSAGE_EOS:
+		break;  // Can't tell; keep it.
+	default:
+		return TRUE;
+	}
+	gst_element_set_state(r->pipeline, GST_STATE_NULL);
+	gst_object_unref(r->pipeline);
+	free(r->uri);
+	free(r->validators);
+	free(r);
+	return FALSE;
+}
+
+static void revalidate(const char *uri, const char *validators) {
+	GstElement *source = gst_element_make_from_uri(GST_URI_SRC, uri,
+						       NULL, NULL);
+	GstElement *sink = gst_element_factory_make("fakesink", NULL);
+	if (source == NULL || sink == NULL) {
+		if (source) {
+			gst_object_unref(source);
+		}
+		if (sink) {
+			gst_object_unref(sink);
+		}
+		return;
+	}
+	// We only need the headers. HEAD if the source can (newer
+	// souphttpsrc); otherwise stop after the first buffer, rather than
+	// downloading the whole file again until the bus watch gets to run.
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(source),
+					 "method") != NULL) {
+		g_object_set(G_OBJECT(source), "method", "HEAD", NULL);
+	} else {
+		g_object_set(G_OBJECT(source), "num-buffers", 1, NULL);
+	}
+	struct revalidation *r = malloc(sizeof(*r));
+	r->pipeline = gst_pipeline_new("revalidate");
+	r->uri = strdup(uri);
+	r->validators = strdup(validators);
+	gst_bin_add_many(GST_BIN(r->pipeline), source, sink, NULL);
+	gst_element_link(source, sink);
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(r->pipeline));
+	gst_bus_add_watch(bus, revalidate_bus_callback, r);
+	gst_object_unref(bus);
+	gst_element_set_state(r->pipeline, GST_STATE_PLAYING);
+}
+
+// Returns the file:// uri of the cached copy of the uri or NULL. Free with
+// g_free().
+static gchar *cached_uri_for(const char *uri) {
+	if (!MediaCache_enabled() || !is_http(uri)) {
+		return NULL;
+	}
+	char *validators = NULL;
+	char *path = MediaCache_lookup(uri, &validators);
+	if (path == NULL) {
+		return NULL;
+	}
+	gchar *file_uri = g_filename_to_uri(path, NULL, NULL);
+	if (file_uri != NULL) {
+		Log_info("gstreamer", "Playing '%s' from cache", uri);
+		revalidate(uri, validators);
+	}
+	free(path);
+	free(validators);
+	return file_uri;
+}
+
+// Pad probe on the http source of playbin; writes the stream to the cache.
+static GstPadProbeReturn tee_to_cache(GstPad *pad, GstPadProbeInfo *info,
+				      gpointer userdata) {
+	(void)pad;
+	struct MediaCacheWriter *writer = (struct MediaCacheWriter *) userdata;
+	if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+		GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+		const guint64 offset = GST_BUFFER_OFFSET(buffer);
+		GstMapInfo map;
+		if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+			MediaCache_append(writer, map.data, map.size,
+					  offset == GST_BUFFER_OFFSET_NONE
+					  ? -1 : (int64_t) offset);
+			gst_buffer_unmap(buffer, &map);
+		}
+		return GST_PAD_PROBE_OK;
+	}
+
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_EOS:
+		MediaCache_finish(writer);
+		break;
+	case GST_EVENT_CUSTOM_DOWNSTREAM_STICKY: {
+		const GstStructure *s = gst_event_get_structure(event);
+		if (s != NULL && gst_structure_has_name(s, "http-headers")) {
+			gchar *validators = get_validators(s);
+			MediaCache_set_validators(writer, validators);
+			g_free(validators);
+		}
+		break;
+	}
+	default:
+		break;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+static void start_caching(GstElement *source) {
+	if (g_object_class_find_property(G_OBJECT_GET_CLASS(source),
+					 "location") == NULL) {
+		return;
+	}
+	gchar *location = NULL;
+	g_object_get(G_OBJECT(source), "location", &location, NULL);
+	struct MediaCacheWriter *writer =
+		is_http(location) ? MediaCache_begin(location) : NULL;
+	g_free(location);
+	GstPad *pad = gst_element_get_static_pad(source, "src");
+	if (writer == NULL || pad == NULL) {
+		MediaCache_close(writer);
+		return;
+	}
+	gst_pad_add_probe(pad, (GstPadProbeType)
+			  (GST_PAD_PROBE_TYPE_BUFFER
+			   | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+			  tee_to_cache, writer,
+			  (GDestroyNotify) MediaCache_close);
+	gst_object_unref(pad);
+}
+#else
+// No media cache in 0.10
+static gchar *cached_uri_for(const char *uri) { (void)uri; return NULL; }
+#endif
+
+#if (GST_VERSION_MAJOR >= 1)
+// Timeshift (--gstout-timeshift-mb). A separate pipeline downloads the http
+// stream into a ring buffer on disk, and playbin reads it from there
+// through appsrc. So pausing a live stream doesn't stall the connection:
+// the download just goes on, and we resume where we paused without
+// reconnecting. Seeking back works as long as the data is still in the
+// ring buffer. While playing, the download waits for playback once the
+// ring buffer is full; only while paused does it go on and overwrite the
+// oldest data, so that we stay close to live.
+// Only live streams are timeshifted: a response with a Content-Length is a
+// file, that playbin reads directly and seeks in with range requests.
+static const char kTimeshiftUri[] = "appsrc://timeshift";
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t data_available;
+	pthread_cond_t space_available;
+	int fd;               // unlinked file of 'capacity' bytes; -1: inactive
+	gint64 capacity;
+	gint64 start;         // stream offset of the oldest byte we have
+	gint64 end;           // ... and of the end of what we have.
+	gint64 read_pos;
+	gint64 content_length;
+	int got_headers;
+	int eos;
+	int closed;
+	int paused;           // Download may overwrite what wasn't read yet.
+	GstElement *pipeline; // source ! appsink
+	GstElement *appsrc;   // Our playbin source, once it is set up.
+} timeshift_ = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		 PTHREAD_COND_INITIALIZER, -1, 0, 0, 0, 0, -1, 0, 0, 0, 0,
+		 NULL, NULL };
+
+// How long timeshift_start() waits for the response headers.
+static const int kTimeshiftHeaderWaitSeconds = 3;
+
+// pwrite()/pread() at a stream offset, wrapping around in the ring.
+static void timeshift_io(int write, guint8 *data, gint64 len, gint64 offset) {
+	while (len > 0) {
+		const gint64 pos = offset % timeshift_.capacity;
+		gint64 chunk = timeshift_.capacity - pos;
+		if (chunk > len) {
+			chunk = len;
+		}
+		const ssize_t r = write
+			? pwrite(timeshift_.fd, data, chunk, pos)
+			: pread(timeshift_.fd, data, chunk, pos);
+		if (r <= 0) {
+			Log_error("gstreamer", "Timeshift buffer I/O failed.");
+			return;
+		}
+		data += r;
+		len -= r;
+		offset += r;
+	}
+}
+
+// appsink "new-sample" of the download pipeline; streaming thread.
+static GstFlowReturn timeshift_store(GstElement *appsink, gpointer userdata) {
+	(void)userdata;
+	GstSample *sample = NULL;
+	g_signal_emit_by_name(appsink, "pull-sample", &sample);
+	if (sample == NULL) {
+		return GST_FLOW_EOS;
+	}
+	GstMapInfo map;
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+		pthread_mutex_lock(&timeshift_.mutex);
+		const gint64 size = map.size;
+		while (!timeshift_.closed && !timeshift_.paused
+		       && size <= timeshift_.capacity
+		       && (timeshift_.end + size
+			   - MAX(timeshift_.read_pos, timeshift_.start)
+			   > timeshift_.capacity)) {
+			pthread_cond_wait(&timeshift_.space_available,
+					  &timeshift_.mutex);
+		}
+		if (timeshift_.closed) {
+			pthread_mutex_unlock(&timeshift_.mutex);
+			gst_buffer_unmap(buffer, &map);
+			gst_sample_unref(sample);
+			return GST_FLOW_FLUSHING;
+		}
+		timeshift_io(1, map.data, map.size, timeshift_.end);
+		timeshift_.end += map.size;
+		if (timeshift_.end - timeshift_.start > timeshift_.capacity) {
+			timeshift_.start = timeshift_.end - timeshift_.capacity;
+		}
+		pthread_cond_broadcast(&timeshift_.data_available);
+		pthread_mutex_unlock(&timeshift_.mutex);
+		gst_buffer_unmap(buffer, &map);
+	}
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+// Messages of the download pipeline, handled right in the posting thread.
+static GstBusSyncReply timeshift_bus_handler(GstBus *bus, GstMessage *msg,
+					     gpointer userdata) {
+	(void)bus;
+	(void)userdata;
+	const GstStructure *s = NULL;
+	pthread_mutex_lock(&timeshift_.mutex);
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_ERROR:
+	case GST_MESSAGE_EOS:
+		// Let the reader play out what we have.
+		timeshift_.eos = 1;
+		pthread_cond_broadcast(&timeshift_.data_available);
+		break;
+	case GST_MESSAGE_ELEMENT:
+		s = gst_message_get_structure(msg);
+		if (s != NULL && gst_structure_has_name(s, "http-headers")) {
+			gchar *validators = get_validators(s);
+			const char *len = strstr(validators, "Content-Length: ");
+			if (len != NULL && len[16] != '\n') {
+				timeshift_.content_length = atoll(len + 16);
+				if (timeshift_.appsrc != NULL) {
+					g_object_set(G_OBJECT(timeshift_.appsrc), "size",
+						     timeshift_.content_length,
+						     NULL);
+				}
+			}
+			g_free(validators);
+			timeshift_.got_headers = 1;
+			pthread_cond_broadcast(&timeshift_.data_available);
+		}
+		break;
+	default:
+		break;
+	}
+	pthread_mutex_unlock(&timeshift_.mutex);
+	return GST_BUS_DROP;
+}
+
+// Wakes up and releases everything. Needs to be called before the playbin
+// reading from it stops, as that might wait for data in timeshift_read().
+static void timeshift_stop(void) {
+	pthread_mutex_lock(&timeshift_.mutex);
+	timeshift_.closed = 1;
+	pthread_cond_broadcast(&timeshift_.data_available);
+	pthread_cond_broadcast(&timeshift_.space_available);
+	GstElement *pipeline = timeshift_.pipeline;
+	GstElement *appsrc = timeshift_.appsrc;
+	timeshift_.pipeline = NULL;
+	timeshift_.appsrc = NULL;
+	pthread_mutex_unlock(&timeshift_.mutex);
+
+	// Outside the lock; the streaming thread might wait for it.
+	if (pipeline != NULL) {
+		gst_element_set_state(pipeline, GST_STATE_NULL);
+		gst_object_unref(pipeline);
+	}
+	if (appsrc != NULL) {
+		gst_object_unref(appsrc);
+	}
+	pthread_mutex_lock(&timeshift_.mutex);
+	if (timeshift_.fd >= 0) {
+		close(timeshift_.fd);
+		timeshift_.fd = -1;
+	}
+	pthread_mutex_unlock(&timeshift_.mutex);
+}
+
+// Starts downloading the uri. Returns the uri for playbin to read it from
+// the timeshift buffer, or NULL if that didn't work or it isn't live.
+static const char *timeshift_start(const char *uri) {
+	timeshift_stop();
+	GstElement *source = gst_element_make_from_uri(GST_URI_SRC, uri,
+						       NULL, NULL);
+	GstElement *appsink = gst_element_factory_make("appsink", NULL);
+	char *path = g_strdup_printf("%s/gmrender-timeshift-XXXXXX",
+				     g_get_tmp_dir());
+	const int fd = mkstemp(path);
+	if (fd >= 0) {
+		unlink(path);  // Only we need to know about it.
+	}
+	g_free(path);
+	if (source == NULL || appsink == NULL || fd < 0) {
+		Log_error("gstreamer", "Can't set up timeshift for '%s'", uri);
+		if (source) {
+			gst_object_unref(source);
+		}
+		if (appsink) {
+			gst_object_unref(appsink);
+		}
+		if (fd >= 0) {
+			close(fd);
+		}
+		return NULL;
+	}
+	g_object_set(G_OBJECT(appsink), "sync", FALSE,
+		     "emit-signals", TRUE, NULL);
+	g_signal_connect(appsink, "new-sample",
+			 G_CALLBACK(timeshift_store), NULL);
+	GstElement *pipeline = gst_pipeline_new("timeshift");
+	gst_bin_add_many(GST_BIN(pipeline), source, appsink, NULL);
+	gst_element_link(source, appsink);
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+	gst_bus_set_sync_handler(bus, timeshift_bus_handler, NULL, NULL);
+	gst_object_unref(bus);
+
+	pthread_mutex_lock(&timeshift_.mutex);
+	timeshift_.fd = fd;
+	timeshift_.capacity = timeshift_mb * 1e6;
+	timeshift_.start = timeshift_.end = timeshift_.read_pos = 0;
+	timeshift_.content_length = -1;
+	timeshift_.got_headers = 0;
+	timeshift_.eos = 0;
+	timeshift_.closed = 0;
+	timeshift_.paused = 0;
+	timeshift_.pipeline = pipeline;
+	pthread_mutex_unlock(&timeshift_.mutex);
+
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+	// Need the response to tell a live stream from a file. Without
+	// headers (not souphttpsrc), we keep timeshifting.
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += kTimeshiftHeaderWaitSeconds;
+	pthread_mutex_lock(&timeshift_.mutex);
+	while (!timeshift_.got_headers && !timeshift_.eos
+	       && pthread_cond_timedwait(&timeshift_.data_available,
+					 &timeshift_.mutex, &deadline) == 0) {
+		// Wait.
+	}
+	const gint64 content_length = timeshift_.content_length;
+	pthread_mutex_unlock(&timeshift_.mutex);
+	if (content_length >= 0) {
+		Log_info("gstreamer", "'%s' has a length; not timeshifting.",
+			 uri);
+		timeshift_stop();
+		return NULL;
+	}
+	Log_info("gstreamer", "Timeshift up to %.1fMB of '%s'",
+		 timeshift_mb, uri);
+	return kTimeshiftUri;
+}
+
+// appsrc "need-data"; streaming thread of playbin.
+static void timeshift_read(GstElement *appsrc, guint length,
+			   gpointer userdata) {
+	(void)userdata;
+	if (length == 0 || length > 65536) {
+		length = 65536;
+	}
+	pthread_mutex_lock(&timeshift_.mutex);
+	while (!timeshift_.closed && !timeshift_.eos
+	       && timeshift_.read_pos >= timeshift_.end) {
+		pthread_cond_wait(&timeshift_.data_available,
+				  &timeshift_.mutex);
+	}
+	if (timeshift_.closed) {
+		pthread_mutex_unlock(&timeshift_.mutex);
+		return;
+	}
+	if (timeshift_.read_pos < timeshift_.start) {
+		Log_info("gstreamer", "Timeshift buffer overrun; skipping "
+			 "%" PRId64 " bytes.",
+			 timeshift_.start - timeshift_.read_pos);
+		timeshift_.read_pos = timeshift_.start;
+	}
+	gint64 available = timeshift_.end - timeshift_.read_pos;
+	if (available <= 0) {
+		pthread_mutex_unlock(&timeshift_.mutex);
+		GstFlowReturn ret;
+		g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
+		return;
+	}
+	if (available > length) {
+		available = length;
+	}
+	GstBuffer *buffer = gst_buffer_new_allocate(NULL, available, NULL);
+	GstMapInfo map;
+	gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+	timeshift_io(0, map.data, available, timeshift_.read_pos);
+	gst_buffer_unmap(buffer, &map);
+	GST_BUFFER_OFFSET(buffer) = timeshift_.read_pos;
+	timeshift_.read_pos += available;
+	pthread_cond_broadcast(&timeshift_.space_available);
+	pthread_mutex_unlock(&timeshift_.mutex);
+
+	GstFlowReturn ret;
+	g_signal_emit_by_name(appsrc, "push-buffer", buffer, &ret);
+	gst_buffer_unref(buffer);
+}
+
+// appsrc "seek-data": byte offset in the stream.
+static gboolean timeshift_seek(GstElement *appsrc, guint64 offset,
+			       gpointer userdata) {
+	(void)appsrc;
+	(void)userdata;
+	pthread_mutex_lock(&timeshift_.mutex);
+	// We can't go back further than we have, but forward is fine, we
+	// just wait until the download gets there.
+	const gboolean ok = ((gint64) offset >= timeshift_.start
+			     && !(timeshift_.eos
+				  && (gint64) offset > timeshift_.end));
+	if (ok) {
+		timeshift_.read_pos = offset;
+		pthread_cond_broadcast(&timeshift_.space_available);
+	}
+	pthread_mutex_unlock(&timeshift_.mutex);
+	return ok;
+}
+
+// While paused, the download goes on regardless of what wasn't played yet.
+static void timeshift_set_paused(int paused) {
+	pthread_mutex_lock(&timeshift_.mutex);
+	timeshift_.paused = paused;
+	pthread_cond_broadcast(&timeshift_.space_available);
+	pthread_mutex_unlock(&timeshift_.mutex);
+}
+
+// Hooks up the appsrc of playbin if we're timeshifting. Returns 1 if so.
+static int timeshift_attach(GstElement *appsrc) {
+	pthread_mutex_lock(&timeshift_.mutex);
+	if (timeshift_.pipeline == NULL || timeshift_.appsrc != NULL) {
+		pthread_mutex_unlock(&timeshift_.mutex);
+		return 0;
+	}
+	timeshift_.appsrc = gst_object_ref(appsrc);
+	g_object_set(G_OBJECT(appsrc),
+		     "stream-type", 1 /* GST_APP_STREAM_TYPE_SEEKABLE */,
+		     "size", timeshift_.content_length, NULL);
+	pthread_mutex_unlock(&timeshift_.mutex);
+	g_signal_connect(appsrc, "need-data", G_CALLBACK(timeshift_read), NULL);
+	g_signal_connect(appsrc, "seek-data", G_CALLBACK(timeshift_seek), NULL);
+	return 1;
+}
+#else
+// No timeshift in 0.10
+static const char *timeshift_start(const char *uri) { (void)uri; return NULL; }
+static void timeshift_stop(void) {}
+static void timeshift_set_paused(int paused) { (void)paused; }
+#endif
+
+#if (GST_VERSION_MAJOR >= 1)
+// Prefetching the next stream. Once the next uri is known, a small pipeline
+// starts downloading (or even decoding) it into a bounded queue. When
+// playbin gets to that stream, it reads it from there through appsrc://,
+// so a slow server or decoder setup doesn't leave a gap between the tracks.
+struct prefetch {
+	char *uri;             // strdup()ed
+	GstElement *pipeline;  // source ! queue ! appsink
+	GstElement *appsink;
+	int decoded;           // appsink delivers raw audio, not the stream.
+	int tags_sent;         // Tags of the decoded stream passed on.
+};
+static pthread_mutex_t prefetch_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static struct prefetch prefetch_ = { NULL, NULL, NULL, 0, 0 };  // next
+static struct prefetch feeding_ = { NULL, NULL, NULL, 0, 0 };   // playing
+
+static void prefetch_release(struct prefetch *p) {
+	if (p->pipeline != NULL) {
+		// Also wakes up a pending pull-sample in feed_prefetched()
+		gst_element_set_state(p->pipeline, GST_STATE_NULL);
+		gst_object_unref(p->pipeline);
+	}
+	free(p->uri);
+	p->uri = NULL;
+	p->pipeline = NULL;
+	p->appsink = NULL;
+	p->decoded = 0;
+	p->tags_sent = 0;
+}
+
+// Pipeline downloading the uri into a queue of --gstout-prefetch-mb.
+static GstElement *create_download_pipeline(const char *uri,
+					    GstElement **appsink) {
+	GstElement *source = gst_element_make_from_uri(GST_URI_SRC, uri,
+						       NULL, NULL);
+	GstElement *queue = gst_element_factory_make("queue", NULL);
+	*appsink = gst_element_factory_make("appsink", NULL);
+	if (source == NULL || queue == NULL || *appsink == NULL) {
+		GstElement *created[] = { source, queue, *appsink };
+		for (int i = 0; i < 3; ++i) {
+			if (created[i] != NULL) {
+				gst_object_unref(created[i]);
+			}
+		}
+		return NULL;
+	}
+	// The queue holds the prefetched data; once full, the source blocks.
+	// Its connection then stays open, but idle, until playback of this
+	// stream drains the queue. A server dropping idle connections in the
+	// meantime shows up as an early end of the stream.
+	g_object_set(G_OBJECT(queue),
+		     "max-size-bytes", (guint) (prefetch_mb * 1e6),
+		     "max-size-buffers", 0,
+		     "max-size-time", (guint64) 0,
+		     NULL);
+	g_object_set(G_OBJECT(*appsink), "sync", FALSE, "max-buffers", 1, NULL);
+
+	GstElement *pipeline = gst_pipeline_new("prefetch");
+	gst_bin_add_many(GST_BIN(pipeline), source, queue, *appsink, NULL);
+	gst_element_link_many(source, queue, *appsink, NULL);
+	return pipeline;
+}
+
+// Pipeline decoding the audio of the uri into a queue of
+// --gstout-predecode-seconds. The decoder already sets up the stream and
+// trims encoder delay and padding, so at the track boundary there is
+// nothing left to do but to hand over the samples. Once playing, it stays
+// at most that far ahead of playback; seeks are passed on to it.
+static GstElement *create_decode_pipeline(const char *uri,
+					  GstElement **appsink) {
+	gchar *description = g_strdup_printf(
+		"uridecodebin name=decoder caps=audio/x-raw "
+		"expose-all-streams=false ! audioconvert ! "
+		"queue max-size-buffers=0 max-size-bytes=0 "
+		"max-size-time=%" PRIu64 " ! "
+		"appsink name=sink sync=false max-buffers=1",
+		(guint64) (predecode_seconds * 1e9));
+	GError *error = NULL;
+	GstElement *pipeline = gst_parse_launch(description, &error);
+	g_free(description);
+	if (pipeline == NULL || error != NULL) {
+		Log_error("gstreamer", "Can't create decode pipeline: %s",
+			  error ? error->message : "?");
+		if (error) {
+			g_error_free(error);
+		}
+		if (pipeline) {
+			gst_object_unref(pipeline);
+		}
+		return NULL;
+	}
+	GstElement *decoder = gst_bin_get_by_name(GST_BIN(pipeline), "decoder");
+	g_object_set(G_OBJECT(decoder), "uri", uri, NULL);
+	gst_object_unref(decoder);
+	// The bin holds a reference as long as we need it.
+	*appsink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+	gst_object_unref(*appsink);
+	return pipeline;
+}
+
+static void prefetch_start(const char *uri) {
+	pthread_mutex_lock(&prefetch_mutex_);
+	prefetch_release(&prefetch_);
+	const int decode = predecode_seconds > 0;
+	const int download = (prefetch_mb > 0 && uri != NULL
+			      && (g_str_has_prefix(uri, "http://")
+				  || g_str_has_prefix(uri, "https://")));
+	if (uri == NULL || !(decode || download)) {
+		pthread_mutex_unlock(&prefetch_mutex_);
+		return;
+	}
+	GstElement *appsink = NULL;
+	GstElement *pipeline = decode
+		? create_decode_pipeline(uri, &appsink)
+		: create_download_pipeline(uri, &appsink);
+	if (pipeline == NULL) {
+		Log_error("gstreamer", "Can't prefetch '%s'", uri);
+		pthread_mutex_unlock(&prefetch_mutex_);
+		return;
+	}
+	// Nobody listens; errors just show up as an early end of stream.
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+	gst_bus_set_flushing(bus, TRUE);
+	gst_object_unref(bus);
+
+	if (decode) {
+		Log_info("gstreamer", "Decoding up to %.1fs of '%s' ahead",
+			 predecode_seconds, uri);
+	} else {
+		Log_info("gstreamer", "Prefetching up to %.1fMB of '%s'",
+			 prefetch_mb, uri);
+	}
+	gst_element_set_state(pipeline, GST_STATE_PLAYING);
+	prefetch_.uri = strdup(uri);
+	prefetch_.pipeline = pipeline;
+	prefetch_.appsink = appsink;
+	prefetch_.decoded = decode;
+	pthread_mutex_unlock(&prefetch_mutex_);
+}
+
+// Returns the uri playbin should use to play the given next stream:
+// appsrc:// if we prefetched it, otherwise just the uri.
+static const char *take_prefetched(const char *uri) {
+	const char *result = uri;
+	pthread_mutex_lock(&prefetch_mutex_);
+	// Previous stream is done; close its connection.
+	prefetch_release(&feeding_);
+	if (uri != NULL && prefetch_.uri != NULL
+	    && strcmp(uri, prefetch_.uri) == 0) {
+		feeding_ = prefetch_;
+		prefetch_.uri = NULL;
+		prefetch_.pipeline = NULL;
+		prefetch_.appsink = NULL;
+		prefetch_.decoded = 0;
+		prefetch_.tags_sent = 0;
+		result = "appsrc://";
+	}
+	pthread_mutex_unlock(&prefetch_mutex_);
+	return result;
+}
+
+// Needs to be called before playbin stops, as it might wait for more data
+// in feed_prefetched().
+static void stop_feeding(void) {
+	pthread_mutex_lock(&prefetch_mutex_);
+	prefetch_release(&feeding_);
+	pthread_mutex_unlock(&prefetch_mutex_);
+}
+
+// appsink only hands out samples; the tags of the decoded stream stay
+// behind as sticky events on its pad. Pushing them on through appsrc lets
+// playbin post them as for any other stream.
+static void forward_tags(GstElement *appsink, GstElement *appsrc) {
+	GstPad *pad = gst_element_get_static_pad(appsink, "sink");
+	if (pad == NULL) {
+		return;
+	}
+	GstEvent *event;
+	for (guint i = 0;
+	     (event = gst_pad_get_sticky_event(pad, GST_EVENT_TAG, i)) != NULL;
+	     ++i) {
+		// Queued by the source and sent ahead of the next buffer.
+		gst_element_send_event(appsrc, event);
+	}
+	gst_object_unref(pad);
+}
+
+// appsrc "need-data" callback; called in the streaming thread.
+static void feed_prefetched(GstElement *appsrc, guint length,
+			    gpointer userdata) {
+	(void)length;
+	(void)userdata;
+	GstElement *appsink = NULL;
+	int decoded = 0;
+	int send_tags = 0;
+	pthread_mutex_lock(&prefetch_mutex_);
+	if (feeding_.appsink != NULL) {
+		appsink = gst_object_ref(feeding_.appsink);
+		decoded = feeding_.decoded;
+		send_tags = decoded && !feeding_.tags_sent;
+		feeding_.tags_sent |= send_tags;
+	}
+	pthread_mutex_unlock(&prefetch_mutex_);
+
+	GstSample *sample = NULL;
+	if (appsink != NULL) {
+		g_signal_emit_by_name(appsink, "pull-sample", &sample);
+		// The tags came before the first sample.
+		if (send_tags && sample != NULL) {
+			forward_tags(appsink, appsrc);
+		}
+		gst_object_unref(appsink);
+	}
+	GstFlowReturn ret;
+	if (sample == NULL) {
+		g_signal_emit_by_name(appsrc, "end-of-stream", &ret);
+		return;
+	}
+	if (decoded) {
+		// Sample keeps caps and timestamps of the decoder.
+		g_signal_emit_by_name(appsrc, "push-sample", sample, &ret);
+	} else {
+		g_signal_emit_by_name(appsrc, "push-buffer",
+				      gst_sample_get_buffer(sample), &ret);
+	}
+	gst_sample_unref(sample);
+}
+
+// appsrc "seek-data": the download (or decode) pipeline is the actual
+// source of the stream, so a seek just goes there. The offset is in bytes,
+// or in nanoseconds for decoded audio.
+static gboolean seek_prefetched(GstElement *appsrc, guint64 offset,
+				gpointer userdata) {
+	(void)appsrc;
+	(void)userdata;
+	GstElement *pipeline = NULL;
+	int decoded = 0;
+	pthread_mutex_lock(&prefetch_mutex_);
+	if (feeding_.pipeline != NULL) {
+		pipeline = gst_object_ref(feeding_.pipeline);
+		decoded = feeding_.decoded;
+	}
+	pthread_mutex_unlock(&prefetch_mutex_);
+	if (pipeline == NULL) {
+		return FALSE;
+	}
+	const gboolean ok = decoded
+		? gst_element_seek_simple(pipeline, GST_FORMAT_TIME,
+					  GST_SEEK_FLAG_FLUSH
+					  | GST_SEEK_FLAG_ACCURATE, offset)
+		: gst_element_seek_simple(pipeline, GST_FORMAT_BYTES,
+					  GST_SEEK_FLAG_FLUSH, offset);
+	gst_object_unref(pipeline);
+	return ok;
+}
+
+// Makes the appsrc seekable if we know the size (or duration) of the
+// stream; otherwise demuxers can't find an index at the end, nor can the
+// transport seek or show the track length.
+static void attach_prefetched(GstElement *appsrc) {
+	pthread_mutex_lock(&prefetch_mutex_);
+	const GstFormat format =
+		feeding_.decoded ? GST_FORMAT_TIME : GST_FORMAT_BYTES;
+	gint64 size = -1;
+	if (feeding_.pipeline == NULL
+	    || !gst_element_query_duration(feeding_.pipeline, format, &size)) {
+		size = -1;
+	}
+	if (feeding_.decoded) {
+		g_object_set(G_OBJECT(appsrc), "format",
+			     GST_FORMAT_TIME, NULL);
+		if (size > 0
+		    && g_object_class_find_property(G_OBJECT_GET_CLASS(appsrc),
+						    "duration") != NULL) {
+			g_object_set(G_OBJECT(appsrc),
+				     "duration", (guint64) size, NULL);
+		}
+	} else if (size > 0) {
+		g_object_set(G_OBJECT(appsrc), "size", size, NULL);
+	}
+	if (size > 0) {
+		g_object_set(G_OBJECT(appsrc),
+			     "stream-type", 1 /* GST_APP_STREAM_TYPE_SEEKABLE */,
+			     NULL);
+		g_signal_connect(appsrc, "seek-data",
+				 G_CALLBACK(seek_prefetched), NULL);
+	}
+	pthread_mutex_unlock(&prefetch_mutex_);
+	g_signal_connect(appsrc, "need-data",
+			 G_CALLBACK(feed_prefetched), NULL);
+}
+
+// playbin "source-setup" callback.
+static void setup_source(GstElement *player, GstElement *source,
+			 gpointer userdata) {
+	(void)player;
+	(void)userdata;
+	// rtspsrc and rtpsrc; that is the latency of their jitterbuffer.
+	// Other sources may have a "latency" of another type and unit.
+	GParamSpec *latency =
+		g_object_class_find_property(G_OBJECT_GET_CLASS(source),
+					     "latency");
+	if (rtp_latency_ms >= 0 && latency != NULL
+	    && G_PARAM_SPEC_VALUE_TYPE(latency) == G_TYPE_UINT) {
+		Log_info("gstreamer", "Setting %s latency to %dms",
+			 GST_OBJECT_NAME(source), rtp_latency_ms);
+		g_object_set(G_OBJECT(source), "latency",
+			     (guint) rtp_latency_ms, NULL);
+	}
+	GstElementFactory *factory = gst_element_get_factory(source);
+	if (factory != NULL
+	    && strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)),
+		      "appsrc") == 0) {
+		if (timeshift_attach(source)) {
+			return;
+		}
+		attach_prefetched(source);
+	} else if (MediaCache_enabled()) {
+		start_caching(source);
+	}
+}
+#else
+// No prefetching in 0.10
+static void prefetch_start(const char *uri) { (void)uri; }
+static const char *take_prefetched(const char *uri) { return uri; }
+static void stop_feeding(void) {}
+#endif
+
+// Adaptive buffering. How much we need to buffer depends on how close the
+// download throughput comes to the bitrate of the stream: with plenty of
+// headroom, the buffer refills quickly after any hiccup, so a short one
+// that fills fast is enough. Close to the bitrate, the buffer has to cover
+// every stall. The bitrate comes from the tags, or, if there are none (raw
+// PCM, mostly also lossless), from the decoded caps; the throughput is the
+// input rate queue2 measures while buffering.
+static pthread_mutex_t buffer_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static gint64 throughput_ = 0;  // bits/s; the same link for all streams.
+static guint connection_kbps_ = 0;  // As last given to the adaptive demuxer.
+
+static void apply_connection_speed(struct pipeline *p);
+
+static void keep_element(GstElement **slot, GstElement *element) {
+	pthread_mutex_lock(&buffer_mutex_);
+	if (*slot != NULL) {
+		gst_object_unref(*slot);
+	}
+	*slot = element ? gst_object_ref(element) : NULL;
+	pthread_mutex_unlock(&buffer_mutex_);
+}
+
+// queue2 keeps the stream's bytes up to its limits, so this is the one
+// element we have to resize while it plays. HLS and DASH demuxers pick
+// the variant to download; we tell them how fast the connection is.
+#if GST_CHECK_VERSION(1,10,0)
+static void remember_element(GstBin *bin, GstBin *sub_bin,
+			     GstElement *element, gpointer userdata) {
+	(void)bin;
+	(void)sub_bin;
+	struct pipeline *p = (struct pipeline *) userdata;
+	GstElementFactory *factory = gst_element_get_factory(element);
+	if (factory == NULL) {
+		return;
+	}
+	const char *klass = gst_element_factory_get_metadata(
+		factory, GST_ELEMENT_METADATA_KLASS);
+	if (strcmp(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)),
+		   "queue2") == 0) {
+		if (buffer_adaptive) {
+			keep_element(&p->queue, element);
+		}
+	} else if (klass != NULL && strstr(klass, "Demuxer/Adaptive")) {
+		Log_info("gstreamer", "%s: adaptive stream (%s)",
+			 GST_OBJECT_NAME(p->player), GST_OBJECT_NAME(element));
+		keep_element(&p->demux, element);
+		connection_kbps_ = 0;  // Not told anything yet.
+		// adaptivedemux2 has both, the older dashdemux only a max.
+		if (adaptive_min_kbps > 0
+		    && g_object_class_find_property(
+			    G_OBJECT_GET_CLASS(element), "min-bitrate")) {
+			g_object_set(G_OBJECT(element), "min-bitrate",
+				     (guint) adaptive_min_kbps * 1000, NULL);
+		}
+		if (adaptive_max_kbps > 0
+		    && g_object_class_find_property(
+			    G_OBJECT_GET_CLASS(element), "max-bitrate")) {
+			g_object_set(G_OBJECT(element), "max-bitrate",
+				     (guint) adaptive_max_kbps * 1000, NULL);
+		}
+		apply_connection_speed(p);
+	}
+}
+#endif
+
+// New stream in this pipeline; nothing known about it yet.
+static void forget_stream_elements(struct pipeline *p) {
+	keep_element(&p->queue, NULL);
+	keep_element(&p->demux, NULL);
+	p->bitrate = 0;
+}
+
+static void adapt_buffer(struct pipeline *p) {
+	double seconds = buffer_min_seconds;
+	if (p->bitrate > 0 && throughput_ > 0) {
+		const double headroom = (double) throughput_ / p->bitrate;
+		if (headroom < 4.0) {
+			// Linear from min at 4x down to max at 1x and below.
+			double f = (4.0 - headroom) / 3.0;
+			if (f > 1.0) f = 1.0;
+			seconds += f * (buffer_max_seconds - buffer_min_seconds);
+		}
+	}
+	// Room for the time limit to be the one that applies.
+	gint64 bytes = buffer_max_mb * 1e6;
+	if (p->bitrate > 0 && seconds * p->bitrate / 8 * 1.5 < bytes) {
+		bytes = seconds * p->bitrate / 8 * 1.5;
+	}
+	const gint64 nanos = seconds * GST_SECOND;
+
+	gint64 current_nanos = 0;
+	gint current_bytes = 0;
+	g_object_get(G_OBJECT(p->player), "buffer-duration", &current_nanos,
+		     "buffer-size", &current_bytes, NULL);
+	// The byte limit moves on its own with the bitrate; a higher
+	// bitrate at the same duration needs it raised.
+	if (llabs(nanos - current_nanos) < current_nanos / 10
+	    && llabs(bytes - current_bytes) < current_bytes / 10) {
+		return;  // Not worth fiddling with.
+	}
+	Log_info("gstreamer", "%s: buffer %.1fs/%" PRId64 "kB for %ukbit/s "
+		 "at %" PRId64 "kbit/s throughput", GST_OBJECT_NAME(p->player),
+		 seconds, bytes / 1000, p->bitrate / 1000,
+		 throughput_ / 1000);
+	// For the next stream, and the one buffering right now.
+	g_object_set(G_OBJECT(p->player), "buffer-duration", nanos,
+		     "buffer-size", (gint) bytes, NULL);
+	pthread_mutex_lock(&buffer_mutex_);
+	if (p->queue != NULL) {
+		g_object_set(G_OBJECT(p->queue), "max-size-time",
+			     (guint64) nanos, "max-size-bytes", (guint) bytes,
+			     NULL);
+	}
+	pthread_mutex_unlock(&buffer_mutex_);
+}
+
+// HLS/DASH: the bitrate of the variant playing right now. It changes when
+// the demuxer switches; small changes are just noise.
+static void set_variant_bitrate(struct pipeline *p, guint bitrate) {
+	if (bitrate == 0
+	    || (p->bitrate > 0 && abs((int) bitrate - (int) p->bitrate)
+		<= (int) p->bitrate / 10)) {
+		return;
+	}
+	Log_info("gstreamer", "%s: variant at %ukbit/s",
+		 GST_OBJECT_NAME(p->player), bitrate / 1000);
+	p->bitrate = bitrate;
+	if (buffer_adaptive) {
+		adapt_buffer(p);
+	}
+}
+
+static void update_bitrate_from_tags(struct pipeline *p,
+				     const GstTagList *tags) {
+	guint bitrate = 0;
+	if (!gst_tag_list_get_uint(tags, GST_TAG_BITRATE, &bitrate)
+	    && !gst_tag_list_get_uint(tags, GST_TAG_NOMINAL_BITRATE,
+				      &bitrate)) {
+		return;
+	}
+	if (p->demux != NULL) {
+		set_variant_bitrate(p, bitrate);
+		return;
+	}
+	// Variable bitrate streams update this all the time; only keep
+	// the peak.
+	if (bitrate > p->bitrate) {
+		p->bitrate = bitrate;
+		if (buffer_adaptive) {
+			adapt_buffer(p);
+		}
+	}
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// No bitrate in the tags: the decoded caps give it for raw PCM, and an upper
+// bound for lossless codecs.
+static void update_bitrate_from_caps(struct pipeline *p) {
+	GstPad *pad = NULL;
+	g_signal_emit_by_name(p->player, "get-audio-pad", 0, &pad);
+	if (pad == NULL) {
+		return;
+	}
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	gst_object_unref(pad);
+	if (caps == NULL) {
+		return;
+	}
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	const gchar *format = gst_structure_get_string(s, "format");
+	gint rate = 0, channels = 0;
+	if (format != NULL
+	    && gst_structure_get_int(s, "rate", &rate)
+	    && gst_structure_get_int(s, "channels", &channels)) {
+		// S16LE, S24_32BE, F32LE, ...: bits per sample follow the
+		// type letter; for padded ones, that is the bits with audio.
+		const int width = atoi(format + 1);
+		p->bitrate = (guint) rate * channels * width;
+	}
+	gst_caps_unref(caps);
+	if (p->bitrate > 0) {
+		adapt_buffer(p);
+	}
+}
+#else
+static void update_bitrate_from_caps(struct pipeline *p) { (void)p; }
+#endif
+
+static void update_throughput(struct pipeline *p, GstMessage *msg,
+			      gint percent) {
+	if (!buffering_ && percent >= 100) {
+		// Full queue: the download only goes as fast as we play, which
+		// says nothing about the link.
+		return;
+	}
+	GstBufferingMode mode;
+	gint avg_in = 0, avg_out = 0;
+	gint64 left = 0;
+	gst_message_parse_buffering_stats(msg, &mode, &avg_in, &avg_out, &left);
+	if (avg_in <= 0) {
+		return;
+	}
+	// Smooth it a bit, the link is the same from stream to stream.
+	const gint64 measured = (gint64) avg_in * 8;
+	throughput_ = (throughput_ > 0)
+		? (3 * throughput_ + measured) / 4 : measured;
+	adapt_buffer(p);
+}
+
+// Adaptive streaming (HLS, DASH). Left alone, the demuxers start with a
+// guess and then follow their own bandwidth estimate, which on slow links
+// oscillates between variants. We measure the throughput from the
+// fragments they download, and give them a conservative connection-speed,
+// within --gstout-adaptive-min-kbps and --gstout-adaptive-max-kbps.
+static gint64 fragment_throughput_ = 0;  // bits/s
+
+static void apply_connection_speed(struct pipeline *p) {
+	// Before the first fragment, start on what we know about the link.
+	gint64 throughput = fragment_throughput_ > 0
+		? fragment_throughput_ : throughput_;
+	// Leave room for fluctuations, so that we don't need to rebuffer.
+	guint kbps = throughput * 0.8 / 1000;
+	if (throughput <= 0) {
+		kbps = adaptive_min_kbps;  // Low: starts quick.
+	}
+	if (adaptive_max_kbps > 0 && kbps > (guint) adaptive_max_kbps) {
+		kbps = adaptive_max_kbps;
+	}
+	if (kbps < (guint) adaptive_min_kbps) {
+		kbps = adaptive_min_kbps;
+	}
+	if (kbps == 0) {
+		return;  // Nothing known; the demuxer's own guess it is.
+	}
+	pthread_mutex_lock(&buffer_mutex_);
+	if (p->demux != NULL
+	    && (connection_kbps_ == 0
+		|| abs((int) kbps - (int) connection_kbps_)
+		> (int) connection_kbps_ / 10)) {
+		Log_info("gstreamer", "%s: connection speed %ukbit/s",
+			 GST_OBJECT_NAME(p->demux), kbps);
+		g_object_set(G_OBJECT(p->demux), "connection-speed", kbps,
+			     NULL);
+		g_object_set(G_OBJECT(p->player), "connection-speed",
+			     (guint64) kbps, NULL);
+		connection_kbps_ = kbps;
+	}
+	pthread_mutex_unlock(&buffer_mutex_);
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Each downloaded fragment: how fast it came. Its start and stop times are
+// when the download ran, not the media time it covers, so they say nothing
+// about the variant's bitrate; that comes from the "playlist" message of
+// hlsdemux or the bitrate tags.
+static void update_fragment_stats(struct pipeline *p,
+				  const GstStructure *stats) {
+	guint64 size = 0, download_time = 0;
+	if (!gst_structure_get_uint64(stats, "fragment-size", &size)
+	    || !gst_structure_get_uint64(stats, "fragment-download-time",
+					 &download_time)
+	    || size == 0 || download_time == 0) {
+		return;
+	}
+	const gint64 measured = size * 8 * GST_SECOND / download_time;
+	fragment_throughput_ = (fragment_throughput_ > 0)
+		? (3 * fragment_throughput_ + measured) / 4 : measured;
+	apply_connection_speed(p);
+}
+#endif
+
+static int is_loaded(const struct pipeline *p, const char *uri) {
+	return (uri != NULL && p->loaded_uri != NULL
+		&& strcmp(uri, p->loaded_uri) == 0);
+}
+
+// Give playbin a new uri. It needs to be in READY or NULL for that.
+static void load_uri(struct pipeline *p, const char *uri) {
+	if (p == active_) {
+		stop_feeding();
+		timeshift_stop();
+	}
+	if (gst_element_set_state(p->player, GST_STATE_READY) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		Log_error("gstreamer", "setting ready state failed");
+		// Error, but continue; can't get worse :)
+	}
+	gchar *cached = cached_uri_for(uri);
+	const char *source_uri = cached ? cached : uri;
+	if (cached == NULL && p == active_ && timeshift_mb > 0 && is_http(uri)) {
+		const char *timeshifted = timeshift_start(uri);
+		if (timeshifted != NULL) {
+			source_uri = timeshifted;
+		}
+	}
+	g_object_set(G_OBJECT(p->player), "uri", source_uri, NULL);
+	g_free(cached);
+	free(p->loaded_uri);
+	p->loaded_uri = uri ? strdup(uri) : NULL;
+	set_fade(p, kNoFade);
+	forget_tags(&p->tags);
+	forget_stream_elements(p);
+}
+
+// Prerolling in an idle pipeline opens its audio sink while the active one
+// still holds its own; see --gstout-pipelines for the sinks that allow that.
+static void preroll(struct pipeline *p, const char *uri) {
+	Log_info("gstreamer", "Preroll '%s' in %s", uri,
+		 GST_OBJECT_NAME(p->player));
+	load_uri(p, uri);
+	if (gst_element_set_state(p->player, GST_STATE_PAUSED) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		Log_error("gstreamer", "Preroll failed.");
+	}
+}
+
+// Returns the idle pipeline that has prerolled the given uri or NULL.
+static struct pipeline *find_prerolled(const char *uri) {
+	for (int i = 0; i < pipeline_count; ++i) {
+		struct pipeline *p = &pipelines_[i];
+		if (p != active_ && is_loaded(p, uri)
+		    && get_player_state(p->player) == GST_STATE_PAUSED) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+// Idle pipeline to preroll the next uri in; round robin, so we recycle
+// the one that has been waiting the longest. NULL if all are busy, i.e.
+// one is still fading out.
+static struct pipeline *next_idle_pipeline(void) {
+	static int next = 0;
+	for (int i = 0; i < pipeline_count; ++i) {
+		next = (next + 1) % pipeline_count;
+		if (&pipelines_[next] != active_
+		    && &pipelines_[next] != fading_out_) {
+			return &pipelines_[next];
+		}
+	}
+	return NULL;
+}
+
+static void stop_fade_out(void) {
+	if (fading_out_ != NULL) {
+		gst_element_set_state(fading_out_->player, GST_STATE_READY);
+		fading_out_ = NULL;
+	}
+}
+
 static void output_gstreamer_set_next_uri(const char *uri) {
 	Log_info("gstreamer", "Set next uri to '%s'", uri);
 	free(gs_next_uri_);
 	gs_next_uri_ = (uri && *uri) ? strdup(uri) : NULL;
+	prefetch_start(gs_next_uri_);
 }
 
 static void output_gstreamer_set_uri(const char *uri,
@@ -155,28 +1681,388 @@ static void output_gstreamer_set_uri(const char *uri,
 	free(gsuri_);
 	gsuri_ = (uri && *uri) ? strdup(uri) : NULL;
 	meta_update_callback_ = meta_cb;
+	next_stream_pending_ = 0;
+	forget_tags(&next_stream_tags_);
+	if (gsuri_ != NULL) {
+		ensure_players();
+	}
+
+	const GstState state = get_current_player_state();
+	if (is_loaded(active_, gsuri_) && state >= GST_STATE_PAUSED) {
+		// Same stream again; keep the pipeline and what we know
+		// about it, as the tags won't be sent again.
+		Log_info("gstreamer", "uri already loaded; keeping pipeline.");
+		return;
+	}
 	SongMetaData_clear(&song_meta_);
+	if (gsuri_ == NULL) {
+		return;
+	}
+
+	if (pipeline_count > 1) {
+		// Prerolling again, even if an idle pipeline already has
+		// this uri, as we just lost the tags.
+		struct pipeline *idle = find_prerolled(gsuri_);
+		if (idle == NULL) {
+			idle = next_idle_pipeline();
+		}
+		if (idle == NULL) {
+			// New track wanted now; cut the fade out short.
+			stop_fade_out();
+			idle = next_idle_pipeline();
+		}
+		preroll(idle, gsuri_);
+		return;
+	}
+
+	// Don't interrupt what is playing right now; the transport only
+	// switches streams on the next Play.
+	if (preroll_on_set_uri && target_state_ != GST_STATE_PLAYING) {
+		target_state_ = GST_STATE_PAUSED;
+		preroll(active_, gsuri_);
+	}
 }
 
-static int output_gstreamer_play(output_transition_cb_t callback) {
-	play_trans_callback_ = callback;
-	if (get_current_player_state() != GST_STATE_PAUSED) {
-		if (gst_element_set_state(player_, GST_STATE_READY) ==
-		    GST_STATE_CHANGE_FAILURE) {
-			Log_error("gstreamer", "setting play state failed (1)");
-			// Error, but continue; can't get worse :)
+// Synchronized playback in several rooms. All pipelines run on a clock
+// shared over the network: either our own, served with
+// --gstout-clock-provider-port, or that of another renderer with
+// --gstout-net-clock. X_PlayAt then sets the same base time everywhere, and
+// a fixed latency makes all sinks render the same sample at the same time.
+static GstClock *shared_clock_ = NULL;
+static int synced_start_ = 0;  // Base time set by us, not the pipeline.
+
+#ifdef HAVE_GST_NET
+static GstNetTimeProvider *time_provider_ = NULL;
+
+static int setup_shared_clock(void) {
+	if (net_clock != NULL) {
+		const char *colon = strrchr(net_clock, ':');
+		const int port = colon ? atoi(colon + 1) : 0;
+		if (colon == NULL || colon == net_clock || port <= 0) {
+			Log_error("gstreamer", "--gstout-net-clock needs "
+				  "HOST:PORT, got '%s'", net_clock);
+			return -1;
+		}
+		gchar *host = g_strndup(net_clock, colon - net_clock);
+		shared_clock_ = gst_net_client_clock_new("net-clock", host,
+							 port, 0);
+		g_free(host);
+		if (shared_clock_ == NULL) {
+			Log_error("gstreamer", "Can't use network clock %s",
+				  net_clock);
+			return -1;
+		}
+#if GST_CHECK_VERSION(1, 6, 0)
+		if (!gst_clock_wait_for_sync(shared_clock_, 5 * GST_SECOND)) {
+			Log_error("gstreamer", "Network clock %s not synced "
+				  "yet; rooms might be off at first.",
+				  net_clock);
+		}
+#endif
+		Log_info("gstreamer", "Using network clock %s", net_clock);
+	}
+	if (clock_provider_port > 0) {
+		if (shared_clock_ == NULL) {
+			shared_clock_ = gst_system_clock_obtain();
+		}
+		time_provider_ = gst_net_time_provider_new(shared_clock_, NULL,
+							   clock_provider_port);
+		if (time_provider_ == NULL) {
+			Log_error("gstreamer", "Can't provide clock on port %d",
+				  clock_provider_port);
+			return -1;
+		}
+		Log_info("gstreamer", "Providing network clock on port %d",
+			 clock_provider_port);
+	}
+	return 0;
+}
+#else
+static int setup_shared_clock(void) {
+	if (net_clock != NULL || clock_provider_port > 0) {
+		Log_error("gstreamer", "Network clock not available; compiled "
+			  "without gstreamer-net.");
+		return -1;
+	}
+	return 0;
+}
+#endif
+
+static void use_shared_clock(GstElement *player) {
+	if (shared_clock_ == NULL) {
+		// Crossfading schedules the next pipeline on the clock of
+		// the current one; the clock of an audio sink would stop
+		// with its pipeline.
+		if (crossfade_seconds > 0) {
+			GstClock *clock = gst_system_clock_obtain();
+			gst_pipeline_use_clock(GST_PIPELINE(player), clock);
+			gst_object_unref(clock);
+		}
+		return;
+	}
+	gst_pipeline_use_clock(GST_PIPELINE(player), shared_clock_);
+#if GST_CHECK_VERSION(1, 6, 0)
+	gst_pipeline_set_latency(GST_PIPELINE(player),
+				 (GstClockTime) sync_latency_ms * GST_MSECOND);
+#endif
+}
+
+// Give the base time back to the pipeline, so that pausing, seeking and
+// playing work as usual again.
+static void end_synced_start(void) {
+	if (synced_start_) {
+		// Any valid start time: the pipeline calculates the actual
+		// one when it goes to PAUSED.
+		gst_element_set_start_time(player_, 0);
+		synced_start_ = 0;
+	}
+}
+
+// Make a prerolled idle pipeline the one we play with.
+static void make_active(struct pipeline *p) {
+	Log_info("gstreamer", "Switching to %s", GST_OBJECT_NAME(p->player));
+	// The old one just goes back to idle; no need to tear anything down.
+	stop_feeding();
+	timeshift_stop();
+	end_synced_start();
+	gst_element_set_state(player_, GST_STATE_READY);
+	active_ = p;
+	player_ = p->player;
+}
+
+// Seeks are called from the UPnP thread, but finish in the main loop.
+static int issue_seek_locked(void) {
+	transition_pending_ = 1;
+	if (!gst_element_seek(player_, playback_rate_, seek_.format,
+			      (GstSeekFlags) (GST_SEEK_FLAG_FLUSH | seek_flags_),
+			      GST_SEEK_TYPE_SET, seek_.position,
+			      GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+		transition_pending_ = 0;
+		seek_.in_flight = 0;
+		return -1;
+	}
+	// The flushing seek prerolls at the new position; we get
+	// an ASYNC_DONE once we're there.
+	seek_.in_flight = 1;
+	seek_.issued_usec = g_get_monotonic_time();
+	return 0;
+}
+
+static int seek_to(GstFormat format, gint64 position) {
+	int rc = 0;
+	if (player_ == NULL) {
+		return -1;  // Nothing loaded.
+	}
+	end_synced_start();
+	pthread_mutex_lock(&seek_mutex_);
+	seek_.format = format;
+	seek_.position = position;
+	if (seek_.in_flight && (g_get_monotonic_time() - seek_.issued_usec
+				< kMaxSeekInFlightUsec)) {
+		// Scrubbing control points send a lot of these. Flushing the
+		// pipeline every time just makes it stutter, so we only do
+		// the latest one once the current seek is done.
+		seek_.queued = 1;
+		seek_.coalesced++;
+	} else {
+		seek_.queued = 0;
+		rc = issue_seek_locked();
+	}
+	pthread_mutex_unlock(&seek_mutex_);
+	return rc;
+}
+
+// A seek (or any other preroll) finished. Returns 1 if we issued
+// a queued seek, so we're still on our way.
+static int seek_done(void) {
+	int reissued = 0;
+	pthread_mutex_lock(&seek_mutex_);
+	if (seek_.in_flight && seek_.queued) {
+		seek_.queued = 0;
+		reissued = (issue_seek_locked() == 0);
+	} else if (seek_.in_flight) {
+		if (seek_.coalesced) {
+			Log_info("gstreamer", "Seek done; coalesced %d requests",
+				 seek_.coalesced);
 		}
-		g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
+		seek_.in_flight = 0;
+		seek_.coalesced = 0;
+	}
+	pthread_mutex_unlock(&seek_mutex_);
+	return reissued;
+}
+
+static void seek_reset(void) {
+	pthread_mutex_lock(&seek_mutex_);
+	seek_.in_flight = 0;
+	seek_.queued = 0;
+	seek_.coalesced = 0;
+	pthread_mutex_unlock(&seek_mutex_);
+}
+
+// If we're seeking, the position to report is where we're going to.
+static int get_seek_target_nanos(gint64 *position) {
+	int seeking = 0;
+	pthread_mutex_lock(&seek_mutex_);
+	if (seek_.in_flight && seek_.format == GST_FORMAT_TIME) {
+		*position = seek_.position;
+		seeking = 1;
 	}
+	pthread_mutex_unlock(&seek_mutex_);
+	return seeking;
+}
+
+static gint64 get_current_position_nanos(void) {
+	gint64 position = last_known_time_.position;
+	if (get_seek_target_nanos(&position)) {
+		return position;
+	}
+#if (GST_VERSION_MAJOR < 1)
+	GstFormat fmt = GST_FORMAT_TIME;
+	GstFormat* query_type = &fmt;
+#else
+	GstFormat query_type = GST_FORMAT_TIME;
+#endif
+	if (!gst_element_query_position(player_, query_type, &position)) {
+		position = last_known_time_.position;
+	}
+	return position;
+}
+
+// Set the rate with a seek to where we are; if we're not prerolled yet, this
+// has to wait until we are.
+static int apply_playback_rate(void) {
+	if (transition_pending_) {
+		rate_change_pending_ = 1;
+		return 0;
+	}
+	if (get_current_player_state() < GST_STATE_PAUSED) {
+		// A freshly started stream plays at normal rate anyway.
+		rate_change_pending_ = (playback_rate_ != 1.0);
+		return 0;
+	}
+	rate_change_pending_ = 0;
+	return seek_to(GST_FORMAT_TIME, get_current_position_nanos());
+}
+
+static int output_gstreamer_set_rate(double rate) {
+	if (rate <= 0) {
+		return -1;  // Can't play audio backwards.
+	}
+	Log_info("gstreamer", "Set playback rate to %.3f", rate);
+	playback_rate_ = rate;
+	return apply_playback_rate();
+}
+
+static void finish_pending_transition(void) {
+	if (!transition_pending_ || buffering_) {
+		return;
+	}
+	transition_pending_ = 0;
+	if (play_trans_callback_) {
+		play_trans_callback_(PLAY_TRANSITION_DONE);
+	}
+}
+
+// Make sure the active pipeline has gsuri_ loaded.
+static void load_for_play(void) {
+	// If paused or prerolled with the current uri, we just flip to PLAYING.
+	if (get_current_player_state() != GST_STATE_PAUSED
+	    || !is_loaded(active_, gsuri_)) {
+		struct pipeline *prerolled = find_prerolled(gsuri_);
+		if (prerolled != NULL) {
+			make_active(prerolled);
+			if (playback_rate_ != 1.0) {
+				// Prerolled at normal speed.
+				rate_change_pending_ = 0;
+				seek_to(GST_FORMAT_TIME, 0);
+			}
+		} else {
+			load_uri(active_, gsuri_);
+		}
+	}
+}
+
+static int output_gstreamer_play(output_transition_cb_t callback) {
+	ensure_players();
+	play_trans_callback_ = callback;
+	transition_pending_ = 1;
+	target_state_ = GST_STATE_PLAYING;
+	end_synced_start();
+	load_for_play();
+	timeshift_set_paused(0);
 	if (gst_element_set_state(player_, GST_STATE_PLAYING) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		Log_error("gstreamer", "setting play state failed (2)");
+		transition_pending_ = 0;
+		return -1;
+	}
+	// Most likely, this state change is asynchronous. We report back
+	// once it is done in my_bus_callback()
+	return 0;
+}
+
+static int output_gstreamer_play_at(gint64 clock_time,
+				    output_transition_cb_t callback) {
+	if (shared_clock_ == NULL) {
+		Log_error("gstreamer", "Synchronized start needs "
+			  "--gstout-net-clock or --gstout-clock-provider-port");
+		return -1;
+	}
+	ensure_players();
+	play_trans_callback_ = callback;
+	transition_pending_ = 1;
+	target_state_ = GST_STATE_PLAYING;
+	end_synced_start();
+	// When resuming, the start time is where we paused; a stream that
+	// is loaded now starts at zero, whatever the pipeline played before.
+	const int resuming = (get_current_player_state() == GST_STATE_PAUSED
+			      && is_loaded(active_, gsuri_));
+	load_for_play();
+	timeshift_set_paused(0);
+	const GstClockTime running_time =
+		resuming ? gst_element_get_start_time(player_) : 0;
+	const GstClockTime now = gst_clock_get_time(shared_clock_);
+	if ((GstClockTime) clock_time < now) {
+		Log_error("gstreamer", "Synchronized start %.3fs in the past; "
+			  "the beginning is skipped.",
+			  (now - clock_time) / 1.0e9);
+	}
+	gst_element_set_start_time(player_, GST_CLOCK_TIME_NONE);
+	gst_element_set_base_time(player_, clock_time - running_time);
+	synced_start_ = 1;
+	Log_info("gstreamer", "Start playing in %.3fs on the shared clock",
+		 ((gint64) clock_time - (gint64) now) / 1.0e9);
+	if (gst_element_set_state(player_, GST_STATE_PLAYING) ==
+	    GST_STATE_CHANGE_FAILURE) {
+		Log_error("gstreamer", "setting play state failed (3)");
+		transition_pending_ = 0;
+		end_synced_start();
 		return -1;
 	}
 	return 0;
 }
 
 static int output_gstreamer_stop(void) {
+	transition_pending_ = 0;
+	buffering_ = 0;
+	underrun_reported_ = 0;
+	next_stream_pending_ = 0;
+	forget_tags(&next_stream_tags_);
+	seek_reset();
+	// Once we play again, the pipeline starts out with normal rate.
+	rate_change_pending_ = (playback_rate_ != 1.0);
+	target_state_ = GST_STATE_READY;
+	stop_fade_out();
+	stop_feeding();
+	timeshift_stop();
+	end_synced_start();
+	if (player_ == NULL || players_released_) {
+		// Never played anything, or released when idle; either way,
+		// nothing to stop, and READY would leave them half re-armed.
+		return 0;
+	}
+	arm_idle_timer();
 	if (gst_element_set_state(player_, GST_STATE_READY) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		return -1;
@@ -186,6 +2072,12 @@ static int output_gstreamer_stop(void) {
 }
 
 static int output_gstreamer_pause(void) {
+	ensure_players();
+	transition_pending_ = 0;
+	target_state_ = GST_STATE_PAUSED;
+	stop_fade_out();
+	end_synced_start();
+	timeshift_set_paused(1);
 	if (gst_element_set_state(player_, GST_STATE_PAUSED) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		return -1;
@@ -195,14 +2087,11 @@ static int output_gstreamer_pause(void) {
 }
 
 static int output_gstreamer_seek(gint64 position_nanos) {
-	if (gst_element_seek(player_, 1.0, GST_FORMAT_TIME,
-			     GST_SEEK_FLAG_FLUSH,
-			     GST_SEEK_TYPE_SET, position_nanos,
-			     GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
-		return -1;
-	} else {
-		return 0;
-	}
+	return seek_to(GST_FORMAT_TIME, position_nanos);
+}
+
+static int output_gstreamer_seek_bytes(gint64 position_bytes) {
+	return seek_to(GST_FORMAT_BYTES, position_bytes);
 }
 
 #if 0
@@ -261,11 +2150,288 @@ static void MetaModify_add_tag(const GstTagList *list, const gchar *tag,
 	}
 }
 
+// Merges the tags into what we know about the song, and tells the
+// transport if anything changed.
+static void update_song_meta(const GstTagList *tags) {
+	if (meta_update_callback_ == NULL) {
+		return;
+	}
+	struct MetaModify modify;
+	modify.meta = &song_meta_;
+	modify.any_change = 0;
+	gst_tag_list_foreach(tags, &MetaModify_add_tag, &modify);
+	if (modify.any_change) {
+		meta_update_callback_(&song_meta_);
+	}
+}
+
+static void next_stream_started(void) {
+	const gint64 delay_usec =
+		g_get_monotonic_time() - next_stream_queued_usec_;
+	Log_info("gstreamer", "Next stream started %" PRId64 "ms after "
+		 "it was queued.", delay_usec / 1000);
+	next_stream_pending_ = 0;
+
+	// Everything we knew about the previous stream is stale now.
+	SongMetaData_clear(&song_meta_);
+	last_known_time_.duration = 0;
+	last_known_time_.position = 0;
+	active_->bitrate = 0;
+	if (next_stream_tags_ != NULL) {
+		update_bitrate_from_tags(active_, next_stream_tags_);
+		update_song_meta(next_stream_tags_);
+		forget_tags(&next_stream_tags_);
+	}
+	if (playback_rate_ != 1.0) {
+		apply_playback_rate();   // new stream, new segment.
+	}
+	if (play_trans_callback_) {
+		play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+	}
+}
+
+// The next uri has been handed to playbin, but it will take a while
+// until it is actually audible (typically a couple of seconds after
+// about-to-finish). Inform the transport only when it started.
+static void next_stream_queued(const char *uri) {
+	forget_tags(&next_stream_tags_);
+#if (GST_VERSION_MAJOR >= 1)
+	Log_info("gstreamer", "Queued next stream %s", uri);
+	next_stream_queued_usec_ = g_get_monotonic_time();
+	next_stream_pending_ = 1;
+#else
+	// No STREAM_START message in 0.10; best we can do is to say it now.
+	SongMetaData_clear(&song_meta_);
+	if (play_trans_callback_) {
+		play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+	}
+#endif
+}
+
+#if (GST_VERSION_MAJOR >= 1)
+// Crossfading. Each playbin has a fader in its audio-filter, that applies the
+// envelope to each sample depending on its stream time. Shortly before the
+// end of a track, the next one prerolls in the idle pipeline; at duration
+// minus crossfade time it starts playing and becomes the active one, while
+// the previous pipeline fades out until its end of stream.
+static const gint64 kCrossfadePrerollNanos = 5 * GST_SECOND;
+// Ahead of time we schedule the start of the next pipeline, so that the
+// 100ms polling doesn't matter.
+static const gint64 kCrossfadeScheduleNanos = GST_SECOND / 2;
+
+static float fade_gain(const struct fade *fade, gint64 t) {
+	float gain = 1.0;
+	if (fade->in_end > 0 && t < fade->in_end) {
+		gain *= sin(G_PI_2 * t / fade->in_end);
+	}
+	if (fade->out_start >= 0 && t > fade->out_start) {
+		if (t >= fade->out_end) {
+			return 0.0;
+		}
+		gain *= cos(G_PI_2 * (t - fade->out_start)
+			    / (fade->out_end - fade->out_start));
+	}
+	return gain;
+}
+
+// Pad probe on the fader; gets interleaved F32 samples.
+static GstPadProbeReturn apply_fade(GstPad *pad, GstPadProbeInfo *info,
+				    gpointer userdata) {
+	const struct pipeline *p = (const struct pipeline *) userdata;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	pthread_mutex_lock(&fade_mutex_);
+	const struct fade fade = p->fade;
+	pthread_mutex_unlock(&fade_mutex_);
+	if ((fade.in_end < 0 && fade.out_start < 0)
+	    || !GST_CLOCK_TIME_IS_VALID(GST_BUFFER_PTS(buffer))) {
+		return GST_PAD_PROBE_OK;
+	}
+	// The envelope is in stream time, as are the positions we got it
+	// from; buffer timestamps only match that until the first seek.
+	GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+	if (event == NULL) {
+		return GST_PAD_PROBE_OK;
+	}
+	GstSegment segment;
+	gst_event_copy_segment(event, &segment);
+	gst_event_unref(event);
+	const guint64 start = gst_segment_to_stream_time(
+		&segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+	if (!GST_CLOCK_TIME_IS_VALID(start)) {
+		return GST_PAD_PROBE_OK;  // Outside of the segment.
+	}
+	gint rate = 0, channels = 0;
+	GstCaps *caps = gst_pad_get_current_caps(pad);
+	if (caps != NULL) {
+		GstStructure *structure = gst_caps_get_structure(caps, 0);
+		gst_structure_get_int(structure, "rate", &rate);
+		gst_structure_get_int(structure, "channels", &channels);
+		gst_caps_unref(caps);
+	}
+	if (rate <= 0 || channels <= 0) {
+		return GST_PAD_PROBE_OK;
+	}
+
+	buffer = gst_buffer_make_writable(buffer);
+	GST_PAD_PROBE_INFO_DATA(info) = buffer;
+	GstMapInfo map;
+	if (!gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+		return GST_PAD_PROBE_OK;
+	}
+	float *samples = (float *) map.data;
+	const gsize frames = map.size / (sizeof(float) * channels);
+	for (gsize f = 0; f < frames; ++f) {
+		const float gain = fade_gain(&fade, start + gst_util_uint64_scale(
+						     f, GST_SECOND, rate));
+		for (int c = 0; c < channels; ++c) {
+			*samples++ *= gain;
+		}
+	}
+	gst_buffer_unmap(buffer, &map);
+	return GST_PAD_PROBE_OK;
+}
+
+// Both pipelines run on the same clock, so the next one gets the base time
+// at which the current one reaches the start of its fade out; the first
+// sample of the fade in is then rendered together with it.
+static void start_crossfade(struct pipeline *next, gint64 duration,
+			    gint64 position, gint64 fade) {
+	Log_info("gstreamer", "Crossfade %.1fs to '%s'",
+		 fade / 1e9, next->loaded_uri);
+	stop_fade_out();  // Very short previous track.
+	end_synced_start();
+	GstClock *clock = gst_pipeline_get_clock(GST_PIPELINE(player_));
+	GstClockTime start_at = GST_CLOCK_TIME_NONE;
+	if (clock != NULL) {
+		start_at = gst_clock_get_time(clock);
+		if (duration - fade > position) {
+			start_at += (duration - fade - position)
+				/ playback_rate_;
+		}
+		gst_object_unref(clock);
+	}
+	pthread_mutex_lock(&fade_mutex_);
+	active_->fade.out_start = duration - fade;
+	active_->fade.out_end = duration;
+	next->fade.in_end = fade;
+	pthread_mutex_unlock(&fade_mutex_);
+	fading_out_ = active_;
+	active_ = next;
+	player_ = next->player;
+
+	free(gsuri_);
+	gsuri_ = gs_next_uri_;
+	gs_next_uri_ = NULL;
+	if (start_at != GST_CLOCK_TIME_NONE) {
+		gst_element_set_start_time(player_, GST_CLOCK_TIME_NONE);
+		gst_element_set_base_time(player_, start_at);
+		synced_start_ = 1;
+	}
+	gst_element_set_state(player_, GST_STATE_PLAYING);
+	next_stream_queued(gsuri_);
+	if (next->tags != NULL) {
+		// Posted while it prerolled for the next uri.
+		keep_tags(&next_stream_tags_, next->tags);
+		next->tags = NULL;
+	}
+	next_stream_started();
+}
+
+// Called regularly in the main loop; watches for the time to crossfade.
+static gboolean crossfade_tick(gpointer userdata) {
+	(void)userdata;
+	if (gs_next_uri_ == NULL || transition_pending_
+	    || target_state_ != GST_STATE_PLAYING
+	    || get_current_player_state() != GST_STATE_PLAYING) {
+		return TRUE;
+	}
+	gint64 duration = 0, position = 0;
+	if (!gst_element_query_duration(player_, GST_FORMAT_TIME, &duration)
+	    || !gst_element_query_position(player_, GST_FORMAT_TIME, &position)
+	    || duration <= 0) {
+		return TRUE;  // Live streams don't end.
+	}
+	// Don't fade over more than half of the track.
+	gint64 fade = crossfade_seconds * GST_SECOND;
+	if (fade > duration / 2) {
+		fade = duration / 2;
+	}
+	const gint64 remaining = duration - position;
+	if (remaining > fade + kCrossfadePrerollNanos) {
+		return TRUE;
+	}
+
+	struct pipeline *next = find_prerolled(gs_next_uri_);
+	if (next == NULL) {
+		int loading = 0;
+		for (int i = 0; i < pipeline_count; ++i) {
+			if (&pipelines_[i] != active_
+			    && is_loaded(&pipelines_[i], gs_next_uri_)) {
+				loading = 1;
+			}
+		}
+		struct pipeline *idle = loading ? NULL : next_idle_pipeline();
+		if (idle != NULL) {  // Else try again once faded out.
+			preroll(idle, gs_next_uri_);
+		}
+	} else if (remaining <= fade + kCrossfadeScheduleNanos) {
+		start_crossfade(next, duration, position, fade);
+	}
+	return TRUE;
+}
+#endif
+
+// Idle pipelines only preroll (or fade out); all we care about is if that
+// worked.
+static void handle_idle_pipeline_message(struct pipeline *p, GstMessage *msg) {
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_EOS:
+		if (p == fading_out_) {
+			Log_info("gstreamer", "%s: faded out",
+				 GST_OBJECT_NAME(p->player));
+			stop_fade_out();
+		}
+		break;
+
+	case GST_MESSAGE_ASYNC_DONE:
+		Log_info("gstreamer", "%s: prerolled '%s'",
+			 GST_OBJECT_NAME(p->player), p->loaded_uri);
+		break;
+
+	case GST_MESSAGE_TAG: {
+		// Only relevant once it plays; keep them until then.
+		GstTagList *tags = NULL;
+		gst_message_parse_tag(msg, &tags);
+		keep_tags(&p->tags, tags);
+		break;
+	}
+
+	case GST_MESSAGE_ERROR: {
+		gchar *debug;
+		GError *err;
+		gst_message_parse_error(msg, &err, &debug);
+		Log_error("gstreamer", "%s: Preroll error: %s (Debug: %s)",
+			  GST_OBJECT_NAME(p->player), err->message, debug);
+		g_error_free(err);
+		g_free(debug);
+		// Don't switch to it; play will then load the uri again in
+		// the active pipeline and report the error.
+		gst_element_set_state(p->player, GST_STATE_READY);
+		free(p->loaded_uri);
+		p->loaded_uri = NULL;
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
 static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 				gpointer data)
 {
 	(void)bus;
-	(void)data;
+	struct pipeline *from = (struct pipeline *) data;
 
 	GstMessageType msgType;
 	const GstObject *msgSrc;
@@ -275,6 +2441,14 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 	msgSrc = GST_MESSAGE_SRC(msg);
 	msgSrcName = GST_OBJECT_NAME(msgSrc);
 
+	// Tags of the stream prerolling for the current uri are already
+	// relevant, everything else from idle pipelines is not.
+	if (from != active_
+	    && !(msgType == GST_MESSAGE_TAG && is_loaded(from, gsuri_))) {
+		handle_idle_pipeline_message(from, msg);
+		return TRUE;
+	}
+
 	switch (msgType) {
 	case GST_MESSAGE_EOS:
 		Log_info("gstreamer", "%s: End-of-stream", msgSrcName);
@@ -284,14 +2458,17 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 			free(gsuri_);
 			gsuri_ = gs_next_uri_;
 			gs_next_uri_ = NULL;
-			gst_element_set_state(player_, GST_STATE_READY);
-			g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
+			load_uri(active_, gsuri_);
 			gst_element_set_state(player_, GST_STATE_PLAYING);
+			next_stream_queued(gsuri_);
+		} else {
+			target_state_ = GST_STATE_READY;  // Nothing more to play.
+			pthread_mutex_lock(&players_mutex_);
+			arm_idle_timer();
+			pthread_mutex_unlock(&players_mutex_);
 			if (play_trans_callback_) {
-				play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+				play_trans_callback_(PLAY_STOPPED);
 			}
-		} else if (play_trans_callback_) {
-			play_trans_callback_(PLAY_STOPPED);
 		}
 		break;
 
@@ -306,12 +2483,72 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 		g_error_free(err);
 		g_free(debug);
 
+		// We won't get anywhere anymore; don't leave the transport
+		// hanging in transition.
+		buffering_ = 0;
+		if (underrun_reported_) {
+			underrun_reported_ = 0;
+			if (play_trans_callback_) {
+				play_trans_callback_(PLAY_BUFFERED);
+			}
+		}
+		seek_reset();
+		finish_pending_transition();
+		break;
+	}
+#if (GST_VERSION_MAJOR >= 1)
+	case GST_MESSAGE_STREAM_START:
+		if (next_stream_pending_) {
+			next_stream_started();
+		}
+		break;
+
+	case GST_MESSAGE_ELEMENT: {
+		const GstStructure *s = gst_message_get_structure(msg);
+		if (s != NULL && gst_structure_has_name(
+			    s, "adaptive-streaming-statistics")) {
+			update_fragment_stats(from, s);
+		} else if (s != NULL && gst_structure_has_name(s, "playlist")) {
+			// hlsdemux switched to another variant.
+			gint bitrate = 0;
+			if (gst_structure_get_int(s, "bitrate", &bitrate)
+			    && bitrate > 0) {
+				set_variant_bitrate(from, bitrate);
+			}
+		}
 		break;
 	}
+#endif
+
+	case GST_MESSAGE_ASYNC_DONE:
+		// Pipeline prerolled after a state change or seek.
+		if (buffer_adaptive && active_->bitrate == 0) {
+			update_bitrate_from_caps(active_);
+		}
+		if (seek_done()) {
+			break;  // Still seeking.
+		}
+		if (rate_change_pending_) {
+			// Prerolled now, so we can finally set the rate.
+			rate_change_pending_ = 0;
+			if (seek_to(GST_FORMAT_TIME,
+				    get_current_position_nanos()) == 0) {
+				break;  // Wait for this seek to finish.
+			}
+		}
+		finish_pending_transition();
+		break;
+
 	case GST_MESSAGE_STATE_CHANGED: {
 		GstState oldstate, newstate, pending;
 		gst_message_parse_state_changed(msg, &oldstate, &newstate,
 						&pending);
+		// Live sources don't preroll, so there won't be an ASYNC_DONE.
+		if (msgSrc == GST_OBJECT(player_)
+		    && newstate == GST_STATE_PLAYING
+		    && pending == GST_STATE_VOID_PENDING) {
+			finish_pending_transition();
+		}
 		/*
 		g_print("GStreamer: %s: State change: '%s' -> '%s', "
 			"PENDING: '%s'\n", msgSrcName,
@@ -325,36 +2562,62 @@ static gboolean my_bus_callback(GstBus * bus, GstMessage * msg,
 	case GST_MESSAGE_TAG: {
 		GstTagList *tags = NULL;
 
-		if (meta_update_callback_ != NULL) {
-			gst_message_parse_tag(msg, &tags);
-			/*g_print("GStreamer: Got tags from element %s\n",
-				GST_OBJECT_NAME (msg->src));
-			*/
-			struct MetaModify modify;
-			modify.meta = &song_meta_;
-			modify.any_change = 0;
-			gst_tag_list_foreach(tags, &MetaModify_add_tag, &modify);
-			gst_tag_list_free(tags);
-			if (modify.any_change) {
-				meta_update_callback_(&song_meta_);
-			}
+		gst_message_parse_tag(msg, &tags);
+		if (next_stream_pending_) {
+			// Most likely from the next stream; the bitrate as
+			// well, so that waits too.
+			keep_tags(&next_stream_tags_, tags);
+			break;
 		}
+		update_bitrate_from_tags(from, tags);
+		update_song_meta(tags);
+		gst_tag_list_free(tags);
 		break;
 	}
 
 	case GST_MESSAGE_BUFFERING:
         {
-                if (buffer_duration <= 0.0) break;  /* nothing to buffer */
+                if (buffer_duration <= 0.0 && !buffer_adaptive) {
+                        break;  /* nothing to buffer */
+                }
 
                 gint percent = 0;
                 gst_message_parse_buffering (msg, &percent);
-
-
-                /* Pause playback until buffering is complete. */
-                if (percent < 100)
+                if (buffer_adaptive) {
+                        update_throughput(from, msg, percent);
+                }
+
+                /* Pause playback below the low watermark, and only resume
+                 * above the high one; on a flaky link, the percentage
+                 * hovers around any single threshold. */
+                if (!buffering_ && percent < buffer_low_percent) {
+                        buffering_ = 1;
+                        buffering_since_usec_ = g_get_monotonic_time();
                         gst_element_set_state(player_, GST_STATE_PAUSED);
-                else
-                        gst_element_set_state(player_, GST_STATE_PLAYING);
+                        if (target_state_ == GST_STATE_PLAYING
+                            && !transition_pending_) {
+                                Log_info("gstreamer", "Buffer underrun "
+                                         "(%d%%)", percent);
+                                underrun_reported_ = 1;
+                                if (play_trans_callback_) {
+                                        play_trans_callback_(PLAY_BUFFERING);
+                                }
+                        }
+                } else if (buffering_ && percent >= buffer_high_percent) {
+                        buffering_ = 0;
+                        Log_info("gstreamer", "Buffered after %" PRId64 "ms",
+                                 (g_get_monotonic_time()
+                                  - buffering_since_usec_) / 1000);
+                        // Might have been only prerolling or paused.
+                        gst_element_set_state(player_, target_state_);
+                        if (underrun_reported_) {
+                                underrun_reported_ = 0;
+                                if (play_trans_callback_) {
+                                        play_trans_callback_(PLAY_BUFFERED);
+                                }
+                        }
+                        finish_pending_transition();
+                }
 		break;
         }
 	default:
@@ -373,6 +2636,15 @@ static gchar *audio_device = NULL;
 static gchar *audio_pipe = NULL;
 static gchar *videosink = NULL;
 static double initial_db = 0.0;
+static gchar *seek_strategy = NULL;
+static gboolean preserve_pitch = FALSE;
+static gchar *output_format = NULL;
+static gchar *cache_dir = NULL;
+static gint cache_mb = 1024;
+static gchar *restream = NULL;
+static gint restream_port = 0;
+static gint idle_seconds = 0;
+static gboolean idle_destroy = FALSE;
 
 /* Options specific to output_gstreamer */
 static GOptionEntry option_entries[] = {
@@ -387,6 +2659,12 @@ static GOptionEntry option_entries[] = {
           "GStreamer audio sink to pipeline"
           "(gst-launch format) useful for further output format conversion.",
 	  NULL },
+        { "gstout-output-format", 0, 0, G_OPTION_ARG_STRING, &output_format,
+          "Always feed the audio sink this format, e.g. "
+          "'rate=48000,channels=2,format=S16LE'. Other formats are "
+          "converted and resampled, so the sink stays open between tracks "
+          "that differ in sample rate or channels.",
+	  NULL },
         { "gstout-videosink", 0, 0, G_OPTION_ARG_STRING, &videosink,
           "GStreamer video sink to use "
 	  "(autovideosink, xvimagesink, ximagesink, ...)",
@@ -394,9 +2672,148 @@ static GOptionEntry option_entries[] = {
         { "gstout-buffer-duration", 0, 0, G_OPTION_ARG_DOUBLE, &buffer_duration,
           "The size of the buffer in seconds. Set to zero to disable buffering.",
           NULL },
+        { "gstout-buffer-adaptive", 0, 0, G_OPTION_ARG_NONE,
+          &buffer_adaptive,
+          "Choose the buffer size for each stream from its bitrate and the "
+          "measured download throughput, between --gstout-buffer-min-seconds "
+          "and --gstout-buffer-max-seconds, and no more than "
+          "--gstout-buffer-max-mb. Overrides --gstout-buffer-duration.",
+          NULL },
+        { "gstout-buffer-min-seconds", 0, 0, G_OPTION_ARG_DOUBLE,
+          &buffer_min_seconds,
+          "Smallest adaptive buffer; for links much faster than the stream. "
+          "Default 1.",
+          NULL },
+        { "gstout-buffer-max-seconds", 0, 0, G_OPTION_ARG_DOUBLE,
+          &buffer_max_seconds,
+          "Largest adaptive buffer; for links hardly faster than the stream. "
+          "Default 10.",
+          NULL },
+        { "gstout-buffer-max-mb", 0, 0, G_OPTION_ARG_DOUBLE, &buffer_max_mb,
+          "Memory limit for the adaptive buffer. Default 8.",
+          NULL },
+        { "gstout-adaptive-min-kbps", 0, 0, G_OPTION_ARG_INT,
+          &adaptive_min_kbps,
+          "HLS/DASH: never tell the demuxer a slower connection than this; "
+          "also where streams start before anything is measured. "
+          "Default 0: no limit.",
+          NULL },
+        { "gstout-adaptive-max-kbps", 0, 0, G_OPTION_ARG_INT,
+          &adaptive_max_kbps,
+          "HLS/DASH: cap for the variant bitrate. Default 0: no limit.",
+          NULL },
+        { "gstout-buffer-low-percent", 0, 0, G_OPTION_ARG_INT,
+          &buffer_low_percent,
+          "Pause to rebuffer when the buffer drops below this fill level. "
+          "Default 10.",
+          NULL },
+        { "gstout-buffer-high-percent", 0, 0, G_OPTION_ARG_INT,
+          &buffer_high_percent,
+          "Resume once the buffer is filled to this level again. "
+          "Default 100.",
+          NULL },
+        { "gstout-prefetch-mb", 0, 0, G_OPTION_ARG_DOUBLE, &prefetch_mb,
+          "Start downloading up to this many megabytes of the next http "
+          "stream as soon as it is known, so that slow servers don't cause "
+          "a gap between tracks. The connection stays open (idle once the "
+          "limit is reached) until the track plays, so servers with a short "
+          "idle timeout may cut it. Zero (default) disables prefetching.",
+          NULL },
+        { "gstout-predecode-seconds", 0, 0, G_OPTION_ARG_DOUBLE,
+          &predecode_seconds,
+          "Decode up to this many seconds of the next track ahead of time "
+          "and hand over the samples at the track boundary; avoids gaps "
+          "from decoder setup and encoder padding (e.g. MP3, AAC). "
+          "Takes precedence over --gstout-prefetch-mb. Zero (default) "
+          "disables.",
+          NULL },
+        { "gstout-crossfade-seconds", 0, 0, G_OPTION_ARG_DOUBLE,
+          &crossfade_seconds,
+          "Crossfade this many seconds between a track and the next one set "
+          "with SetNextAVTransportURI. Uses two pipelines, so the audio sink "
+          "needs to allow being opened twice. Zero (default) disables.",
+          NULL },
+        { "gstout-restream", 0, 0, G_OPTION_ARG_STRING, &restream,
+          "Serve what we play to other renderers, encoded as 'flac' or "
+          "'l16', at /restream.flac or /restream.l16 on "
+          "--gstout-restream-port. Pass that URL to the followers with "
+          "SetAVTransportURI.",
+	  NULL },
+        { "gstout-restream-port", 0, 0, G_OPTION_ARG_INT, &restream_port,
+          "Port to serve --gstout-restream on. Default: 0, any free port "
+          "(see log).",
+	  NULL },
+        { "gstout-cache-dir", 0, 0, G_OPTION_ARG_STRING, &cache_dir,
+          "Keep streams fetched over http in this directory and play them "
+          "from there next time. Changes on the server are picked up on "
+          "the following play.",
+          NULL },
+        { "gstout-cache-mb", 0, 0, G_OPTION_ARG_INT, &cache_mb,
+          "Size limit of the --gstout-cache-dir in megabytes; least "
+          "recently played streams are removed first. Default 1024.",
+          NULL },
+        { "gstout-timeshift-mb", 0, 0, G_OPTION_ARG_DOUBLE, &timeshift_mb,
+          "Read live http streams (no Content-Length) through a ring "
+          "buffer on disk of this many megabytes, that keeps downloading "
+          "while paused. Pausing them then resumes without reconnect and "
+          "allows to seek back within the buffer. Zero (default) disables.",
+          NULL },
+        { "gstout-rtp-latency-ms", 0, 0, G_OPTION_ARG_INT, &rtp_latency_ms,
+          "Accept RTP streams (rtsp:// and rtp://) and "
+          "advertise them in SinkProtocolInfo; jitterbuffer latency in "
+          "milliseconds. Default: off.",
+          NULL },
+        { "gstout-net-clock", 0, 0, G_OPTION_ARG_STRING, &net_clock,
+          "HOST:PORT of a network clock (see --gstout-clock-provider-port) "
+          "to play in sync with other renderers using it.",
+	  NULL },
+        { "gstout-clock-provider-port", 0, 0, G_OPTION_ARG_INT,
+          &clock_provider_port,
+          "Provide our clock to other renderers on this UDP port.",
+	  NULL },
+        { "gstout-sync-latency-ms", 0, 0, G_OPTION_ARG_INT, &sync_latency_ms,
+          "With a network clock: latency of all pipelines, so that every "
+          "room has the same delay. Needs to be larger than that of the "
+          "slowest sink. Default 300.",
+	  NULL },
+        { "gstout-mime-cache", 0, 0, G_OPTION_ARG_STRING, &mime_cache,
+          "File to keep the supported mime types in, so that we don't need "
+          "to scan all plugins on every start. Empty to disable. Default: "
+          "gmediarender/mime-types in the user cache directory.",
+	  NULL },
         { "gstout-initial-volume-db", 0, 0, G_OPTION_ARG_DOUBLE, &initial_db,
           "GStreamer initial volume in decibel (e.g. 0.0 = max; -6 = 1/2 max) ",
 	  NULL },
+        { "gstout-seek-strategy", 0, 0, G_OPTION_ARG_STRING, &seek_strategy,
+          "How to seek: 'accurate' (exact position), 'key-unit' (jump to "
+          "nearest key unit; much faster on long files) or 'snap' (key-unit, "
+          "reported position snapped to it). Default: decoder decides.",
+	  NULL },
+        { "gstout-preserve-pitch", 0, 0, G_OPTION_ARG_NONE, &preserve_pitch,
+          "Keep the pitch when playing faster or slower than normal speed "
+          "(needs the scaletempo element).",
+	  NULL },
+        { "gstout-pipelines", 0, 0, G_OPTION_ARG_INT, &pipeline_count,
+          "Number of pipelines (1..4). With more than one, a new uri "
+          "prerolls in an idle pipeline while the active one keeps playing; "
+          "switching to it is then instant. Prerolling opens the audio "
+          "sink of the idle pipeline while the active one is still open, "
+          "so this needs a mixing sink (e.g. pulsesink or ALSA dmix); an "
+          "exclusive ALSA hw: device fails to preroll.",
+	  NULL },
+        { "gstout-preroll", 0, 0, G_OPTION_ARG_NONE, &preroll_on_set_uri,
+          "Preroll the stream as soon as its uri is set, so that playing "
+          "starts without delay.",
+	  NULL },
+        { "gstout-idle-seconds", 0, 0, G_OPTION_ARG_INT, &idle_seconds,
+          "Release the audio device and decoders this many seconds after "
+          "playback stopped; they are set up again on the next play. "
+          "Default 0: keep them.",
+	  NULL },
+        { "gstout-idle-destroy", 0, 0, G_OPTION_ARG_NONE, &idle_destroy,
+          "When idle, destroy the pipelines instead of only setting them "
+          "to NULL state. Frees more memory, but takes longer to re-arm.",
+	  NULL },
         { NULL }
 };
 
@@ -420,6 +2837,12 @@ static int output_gstreamer_get_position(gint64 *track_duration,
 	*track_duration = last_known_time_.duration;
 	*track_pos = last_known_time_.position;
 
+	if (get_seek_target_nanos(track_pos)) {
+		// The pipeline is busy flushing; report where we're going.
+		last_known_time_.position = *track_pos;
+		return 0;
+	}
+
 	int rc = 0;
 	if (get_current_player_state() != GST_STATE_PLAYING) {
 		return rc;  // playbin2 only returns valid values then.
@@ -445,73 +2868,507 @@ static int output_gstreamer_get_position(gint64 *track_duration,
 	return rc;
 }
 
+static int output_gstreamer_get_stream_bitrate(guint *bitrate) {
+	*bitrate = active_->bitrate;
+	return 0;
+}
+
 static int output_gstreamer_get_volume(float *v) {
-	double volume;
-	g_object_get(player_, "volume", &volume, NULL);
+	double volume = volume_;
+	if (player_ != NULL) {
+		g_object_get(player_, "volume", &volume, NULL);
+	}
 	Log_info("gstreamer", "Query volume fraction: %f", volume);
 	*v = volume;
 	return 0;
 }
 static int output_gstreamer_set_volume(float value) {
 	Log_info("gstreamer", "Set volume fraction to %f", value);
-	g_object_set(player_, "volume", (double) value, NULL);
+	volume_ = value;
+	for (int i = 0; player_ != NULL && i < pipeline_count; ++i) {
+		g_object_set(pipelines_[i].player, "volume", (double) value,
+			     NULL);
+	}
 	return 0;
 }
 static int output_gstreamer_get_mute(int *m) {
-	gboolean val;
-	g_object_get(player_, "mute", &val, NULL);
+	gboolean val = mute_;
+	if (player_ != NULL) {
+		g_object_get(player_, "mute", &val, NULL);
+	}
 	*m = val;
 	return 0;
 }
 static int output_gstreamer_set_mute(int m) {
 	Log_info("gstreamer", "Set mute to %s", m ? "on" : "off");
-	g_object_set(player_, "mute", (gboolean) m, NULL);
+	mute_ = m;
+	for (int i = 0; player_ != NULL && i < pipeline_count; ++i) {
+		g_object_set(pipelines_[i].player, "mute", (gboolean) m, NULL);
+	}
 	return 0;
 }
 
 static void prepare_next_stream(GstElement *obj, gpointer userdata) {
-	(void)obj;
 	(void)userdata;
+	if (obj != player_ || crossfade_seconds > 0) {
+		// Crossfading starts the next track itself (or, if that
+		// didn't work, end-of-stream does).
+		return;
+	}
 
 	Log_info("gstreamer", "about-to-finish cb: setting uri %s",
 		 gs_next_uri_);
 	free(gsuri_);
 	gsuri_ = gs_next_uri_;
 	gs_next_uri_ = NULL;
+	timeshift_stop();  // Current stream is read completely.
 	if (gsuri_ != NULL) {
-		g_object_set(G_OBJECT(player_), "uri", gsuri_, NULL);
-		if (play_trans_callback_) {
-			// TODO(hzeller): can we figure out when we _actually_
-			// start playing this ? there are probably a couple
-			// of seconds between now and actual start.
-			play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+		gchar *cached = cached_uri_for(gsuri_);
+		g_object_set(G_OBJECT(player_), "uri",
+			     cached ? cached : take_prefetched(gsuri_), NULL);
+		g_free(cached);
+		free(active_->loaded_uri);
+		active_->loaded_uri = strdup(gsuri_);
+		next_stream_queued(gsuri_);
+	}
+}
+
+// Returns 0 if this is a known seek strategy.
+static int set_seek_strategy(const char *strategy) {
+	if (strcmp(strategy, "accurate") == 0) {
+		seek_flags_ = GST_SEEK_FLAG_ACCURATE;
+	} else if (strcmp(strategy, "key-unit") == 0) {
+		seek_flags_ = GST_SEEK_FLAG_KEY_UNIT;
+	} else if (strcmp(strategy, "snap") == 0) {
+#if (GST_VERSION_MAJOR < 1)
+		seek_flags_ = GST_SEEK_FLAG_KEY_UNIT;  // No snap flags in 0.10
+#else
+		seek_flags_ = (GstSeekFlags) (GST_SEEK_FLAG_KEY_UNIT
+					      | GST_SEEK_FLAG_SNAP_NEAREST);
+#endif
+	} else {
+		return -1;
+	}
+	return 0;
+}
+
+// Elements between decoder and sink: scaletempo to preserve pitch and the
+// fader for crossfading.
+static GstElement *create_audio_filter(struct pipeline *p) {
+	if (crossfade_seconds <= 0) {
+		GstElement *scaletempo =
+			gst_element_factory_make("scaletempo", NULL);
+		if (scaletempo == NULL) {
+			Log_error("gstreamer", "Couldn't create scaletempo "
+				  "to preserve pitch.");
 		}
+		return scaletempo;
 	}
+#if (GST_VERSION_MAJOR >= 1)
+	gchar *description = g_strdup_printf(
+		"%saudioconvert ! audio/x-raw,format=%s ! "
+		"identity name=fader ! audioconvert",
+		preserve_pitch ? "scaletempo ! " : "",
+		G_BYTE_ORDER == G_LITTLE_ENDIAN ? "F32LE" : "F32BE");
+	GstElement *filter = gst_parse_bin_from_description(description,
+							    TRUE, NULL);
+	g_free(description);
+	if (filter == NULL) {
+		Log_error("gstreamer", "Couldn't create crossfade filter.");
+		return NULL;
+	}
+	GstElement *fader = gst_bin_get_by_name(GST_BIN(filter), "fader");
+	GstPad *pad = gst_element_get_static_pad(fader, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, apply_fade, p, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(fader);
+	return filter;
+#else
+	(void)p;
+	return NULL;
+#endif
 }
 
-static int output_gstreamer_init(void)
-{
-	GstBus *bus;
+// Puts a converter in front of the sink that always gives it the
+// --gstout-output-format. So it doesn't need to be reopened for tracks
+// with a different sample rate or channel layout, which would leave a gap.
+static GstElement *create_fixed_format_sink(GstElement *sink) {
+	if (sink == NULL) {
+		sink = gst_element_factory_make("autoaudiosink", NULL);
+		if (sink == NULL) {
+			Log_error("gstreamer", "Couldn't create autoaudiosink");
+			return NULL;
+		}
+	}
+#if (GST_VERSION_MAJOR < 1)
+	const char media_type[] = "audio/x-raw-int";
+#else
+	const char media_type[] = "audio/x-raw";
+#endif
+	gchar *caps_string = g_strdup_printf("%s,%s", media_type,
+					     output_format);
+	GstCaps *caps = gst_caps_from_string(caps_string);
+	g_free(caps_string);
+	if (caps == NULL) {
+		Log_error("gstreamer", "Invalid --gstout-output-format '%s'",
+			  output_format);
+		return sink;
+	}
+	Log_info("gstreamer", "Fixed output format %s", output_format);
+
+	GstElement *bin = gst_bin_new("fixed-format-sink");
+	GstElement *convert = gst_element_factory_make("audioconvert", NULL);
+	GstElement *resample = gst_element_factory_make("audioresample", NULL);
+	GstElement *filter = gst_element_factory_make("capsfilter", NULL);
+	g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+	gst_caps_unref(caps);
+	gst_bin_add_many(GST_BIN(bin), convert, resample, filter, sink, NULL);
+	gst_element_link_many(convert, resample, filter, sink, NULL);
+
+	GstPad *pad = gst_element_get_static_pad(convert, "sink");
+	gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+	gst_object_unref(pad);
+	return bin;
+}
 
-	SongMetaData_init(&song_meta_);
-	scan_mime_list();
+#if (GST_VERSION_MAJOR >= 1)
+// Re-streaming (--gstout-restream). The audio sink of every pipeline gets a
+// tee that also converts the audio to the restream format. What the active
+// pipeline plays goes into a single encoder and from there into a
+// multifdsink, that serves any number of followers; so we fetch and decode
+// only once, however many rooms listen, and switching pipelines doesn't
+// start a new encoded stream. We accept the http connections ourselves in
+// the main loop and hand them over after the response header, so no thread
+// waits for a follower. Each follower starts live on a frame boundary, with
+// the FLAC stream header first; one that falls behind by more than
+// kRestreamLagBytes skips ahead.
+static const gint64 kRestreamLagBytes = 1 << 20;
+// A follower that doesn't finish its request in time is dropped.
+static const guint kRestreamRequestTimeoutSeconds = 5;
+
+struct restream_format {
+	const char *name;
+	const char *caps;     // What goes into the encoder.
+	const char *encoder;  // NULL: raw
+	const char *path;
+	const char *content_type;
+};
+static const struct restream_format restream_formats[] = {
+	{ "flac", "audio/x-raw,format=S16LE,rate=44100,channels=2",
+	  "flacenc", "/restream.flac", "audio/flac" },
+	// L16 is big endian (RFC 2586).
+	{ "l16", "audio/x-raw,format=S16BE,rate=44100,channels=2",
+	  NULL, "/restream.l16", "audio/L16;rate=44100;channels=2" },
+	{ NULL }
+};
+static const struct restream_format *restream_format_ = NULL;
+
+static struct {
+	GstElement *pipeline;  // appsrc ! [encoder !] multifdsink
+	GstElement *appsrc;
+	GstElement *sink;
+} restream_ = { NULL, NULL, NULL };
+
+// appsink "new-sample" of the restream branch; streaming thread.
+static GstFlowReturn restream_store(GstElement *appsink, gpointer userdata) {
+	GstSample *sample = NULL;
+	g_signal_emit_by_name(appsink, "pull-sample", &sample);
+	if (sample == NULL) {
+		return GST_FLOW_EOS;
+	}
+	// Idle or fading out; only one can be the stream.
+	if ((struct pipeline *) userdata == active_) {
+		// Timestamps start over with each track and pipeline; the
+		// encoder gets them from the appsrc, so they keep going.
+		GstBuffer *buffer =
+			gst_buffer_copy(gst_sample_get_buffer(sample));
+		GST_BUFFER_PTS(buffer) = GST_CLOCK_TIME_NONE;
+		GST_BUFFER_DTS(buffer) = GST_CLOCK_TIME_NONE;
+		GST_BUFFER_DURATION(buffer) = GST_CLOCK_TIME_NONE;
+		GstFlowReturn ret;
+		g_signal_emit_by_name(restream_.appsrc, "push-buffer",
+				      buffer, &ret);
+		gst_buffer_unref(buffer);
+	}
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+// multifdsink "client-fd-removed"; the fd is ours to close.
+static void restream_client_removed(GstElement *sink, gint fd,
+				    gpointer userdata) {
+	(void)sink;
+	(void)userdata;
+	close(fd);
+	Log_info("gstreamer", "Follower disconnected from restream.");
+}
+
+// A follower's connection until its request is complete.
+struct restream_client {
+	int fd;
+	guint watch;
+	guint timeout;
+	char request[1024];
+	size_t len;
+};
+
+static void restream_client_free(struct restream_client *client) {
+	g_source_remove(client->watch);
+	g_source_remove(client->timeout);
+	free(client);
+}
+
+// Answers a complete request. From then on, multifdsink writes the stream
+// to the connection.
+static void restream_respond(int fd, const char *request) {
+	const char *path = strchr(request, ' ');
+	const int is_get = g_str_has_prefix(request, "GET ");
+	const int found = (path != NULL
+			   && (is_get || g_str_has_prefix(request, "HEAD "))
+			   && strncmp(path + 1, restream_format_->path,
+				      strlen(restream_format_->path)) == 0
+			   && strchr(" ?", path[1 + strlen(
+					     restream_format_->path)]) != NULL);
+	gchar *response = found
+		? g_strdup_printf("HTTP/1.0 200 OK\r\n"
+				  "Content-Type: %s\r\n"
+				  "Cache-Control: no-cache\r\n"
+				  "Connection: close\r\n\r\n",
+				  restream_format_->content_type)
+		: g_strdup("HTTP/1.0 404 Not Found\r\n"
+			   "Connection: close\r\n\r\n");
+	const size_t response_len = strlen(response);
+	const int sent = (write(fd, response, response_len)
+			  == (ssize_t) response_len);
+	g_free(response);
+	if (found && is_get && sent) {
+		Log_info("gstreamer", "Follower connected to restream.");
+		g_signal_emit_by_name(restream_.sink, "add", fd);
+	} else {
+		close(fd);
+	}
+}
+
+// Collects the request of a new follower; it may come in several reads.
+static gboolean restream_request(GIOChannel *channel, GIOCondition cond,
+				 gpointer userdata) {
+	(void)channel;
+	(void)cond;
+	struct restream_client *client = (struct restream_client *) userdata;
+	const ssize_t len = read(client->fd, client->request + client->len,
+				 sizeof(client->request) - 1 - client->len);
+	if (len < 0 && errno == EINTR) {
+		return TRUE;
+	}
+	if (len <= 0) {
+		close(client->fd);  // Gone before it asked for anything.
+		restream_client_free(client);
+		return TRUE;  // Removed already.
+	}
+	client->len += len;
+	client->request[client->len] = '\0';
+	// We only need the request line, but must not answer before the
+	// follower is done sending; a too long request just gets a 404.
+	if (strstr(client->request, "\r\n\r\n") == NULL
+	    && strstr(client->request, "\n\n") == NULL
+	    && client->len < sizeof(client->request) - 1) {
+		return TRUE;
+	}
+	restream_respond(client->fd, client->request);
+	restream_client_free(client);
+	return TRUE;  // Removed already.
+}
+
+static gboolean restream_request_timeout(gpointer userdata) {
+	struct restream_client *client = (struct restream_client *) userdata;
+	Log_info("gstreamer", "Follower didn't finish its request in time.");
+	close(client->fd);
+	restream_client_free(client);
+	return TRUE;  // Removed already.
+}
+
+static gboolean restream_accept(GIOChannel *channel, GIOCondition cond,
+				gpointer userdata) {
+	(void)cond;
+	(void)userdata;
+	const int fd = accept(g_io_channel_unix_get_fd(channel), NULL, NULL);
+	if (fd < 0) {
+		return TRUE;
+	}
+	struct restream_client *client = malloc(sizeof(*client));
+	client->fd = fd;
+	client->len = 0;
+	GIOChannel *io = g_io_channel_unix_new(fd);
+	client->watch = g_io_add_watch(io, G_IO_IN | G_IO_HUP | G_IO_ERR,
+				       restream_request, client);
+	g_io_channel_unref(io);  // The watch keeps it.
+	client->timeout = g_timeout_add_seconds(kRestreamRequestTimeoutSeconds,
+						restream_request_timeout,
+						client);
+	return TRUE;
+}
+
+static int restream_listen(void) {
+	const int fd = socket(AF_INET, SOCK_STREAM, 0);
+	const int on = 1;
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(restream_port);
+	if (fd < 0
+	    || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0
+	    || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+	    || listen(fd, 8) != 0
+	    || getsockname(fd, (struct sockaddr *) &addr, &addr_len) != 0) {
+		Log_error("gstreamer", "Can't listen for restream followers "
+			  "on port %d: %s", restream_port, strerror(errno));
+		if (fd >= 0) {
+			close(fd);
+		}
+		return -1;
+	}
+	GIOChannel *channel = g_io_channel_unix_new(fd);
+	g_io_add_watch(channel, G_IO_IN, restream_accept, NULL);
+	g_io_channel_unref(channel);
+	Log_info("gstreamer", "Restreaming as %s at http://<this host>:%d%s",
+		 restream_format_->name, ntohs(addr.sin_port),
+		 restream_format_->path);
+	return 0;
+}
+
+static int restream_init(void) {
+	for (const struct restream_format *f = restream_formats;
+	     f->name != NULL; ++f) {
+		if (strcmp(f->name, restream) == 0) {
+			restream_format_ = f;
+		}
+	}
+	if (restream_format_ == NULL) {
+		Log_error("gstreamer", "Unknown --gstout-restream '%s'. "
+			  "Choose one of flac, l16.", restream);
+		return -1;
+	}
+	restream_.appsrc = gst_element_factory_make("appsrc", NULL);
+	restream_.sink = gst_element_factory_make("multifdsink", NULL);
+	GstElement *encoder = restream_format_->encoder
+		? gst_element_factory_make(restream_format_->encoder, NULL)
+		: NULL;
+	if (restream_.appsrc == NULL || restream_.sink == NULL
+	    || (restream_format_->encoder != NULL && encoder == NULL)) {
+		Log_error("gstreamer", "Restreaming needs appsrc, "
+			  "multifdsink and %s.", restream_format_->encoder
+			  ? restream_format_->encoder : "no encoder");
+		return -1;
+	}
+	GstCaps *caps = gst_caps_from_string(restream_format_->caps);
+	g_object_set(G_OBJECT(restream_.appsrc), "is-live", TRUE,
+		     "format", GST_FORMAT_TIME, "do-timestamp", TRUE,
+		     "caps", caps, NULL);
+	gst_caps_unref(caps);
+	g_object_set(G_OBJECT(restream_.sink), "sync", FALSE, "async", FALSE,
+		     "sync-method", 2 /* latest-keyframe */,
+		     "recover-policy", 3 /* keyframe */,
+		     "unit-format", GST_FORMAT_BYTES,
+		     "units-soft-max", kRestreamLagBytes,
+		     NULL);
+	g_signal_connect(restream_.sink, "client-fd-removed",
+			 G_CALLBACK(restream_client_removed), NULL);
+	restream_.pipeline = gst_pipeline_new("restream");
+	gst_bin_add_many(GST_BIN(restream_.pipeline), restream_.appsrc,
+			 restream_.sink, NULL);
+	if (encoder != NULL) {
+		gst_bin_add(GST_BIN(restream_.pipeline), encoder);
+		gst_element_link_many(restream_.appsrc, encoder,
+				      restream_.sink, NULL);
+	} else {
+		gst_element_link(restream_.appsrc, restream_.sink);
+	}
+	// Nobody listens; followers just see the connection drop on errors.
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(restream_.pipeline));
+	gst_bus_set_flushing(bus, TRUE);
+	gst_object_unref(bus);
+	gst_element_set_state(restream_.pipeline, GST_STATE_PLAYING);
+	return restream_listen();
+}
+
+// Returns a bin that plays to the sink and also feeds the restream branch.
+static GstElement *create_restream_sink(struct pipeline *p,
+					GstElement *sink) {
+	if (sink == NULL) {
+		sink = gst_element_factory_make("autoaudiosink", NULL);
+		if (sink == NULL) {
+			Log_error("gstreamer", "Couldn't create autoaudiosink");
+			return NULL;
+		}
+	}
+	// The branch must never hold up playing; a leaky queue drops instead.
+	gchar *description = g_strdup_printf(
+		"queue leaky=downstream max-size-time=1000000000 "
+		"! audioconvert ! audioresample ! %s "
+		"! appsink name=restream sync=false async=false "
+		"emit-signals=true",
+		restream_format_->caps);
+	GError *error = NULL;
+	GstElement *branch = gst_parse_bin_from_description(description, TRUE,
+							    &error);
+	g_free(description);
+	if (branch == NULL) {
+		Log_error("gstreamer", "Can't create restream branch: %s",
+			  error ? error->message : "?");
+		g_clear_error(&error);
+		return sink;
+	}
+	GstElement *appsink = gst_bin_get_by_name(GST_BIN(branch), "restream");
+	g_signal_connect(appsink, "new-sample", G_CALLBACK(restream_store), p);
+	gst_object_unref(appsink);
+
+	GstElement *bin = gst_bin_new("restream-sink");
+	GstElement *tee = gst_element_factory_make("tee", NULL);
+	GstElement *queue = gst_element_factory_make("queue", NULL);
+	gst_bin_add_many(GST_BIN(bin), tee, queue, sink, branch, NULL);
+	gst_element_link_many(tee, queue, sink, NULL);
+	gst_element_link(tee, branch);
+
+	GstPad *pad = gst_element_get_static_pad(tee, "sink");
+	gst_element_add_pad(bin, gst_ghost_pad_new("sink", pad));
+	gst_object_unref(pad);
+	return bin;
+}
+#endif
 
+// Creates the playbin of a pipeline with all the sinks and filters as
+// configured on the commandline.
+static void create_player(struct pipeline *p, const char *name) {
 #if (GST_VERSION_MAJOR < 1)
 	const char player_element_name[] = "playbin2";
 #else
 	const char player_element_name[] = "playbin";
 #endif
-
-	player_ = gst_element_factory_make(player_element_name, "play");
-	assert(player_ != NULL);
+	GstElement *player = gst_element_factory_make(player_element_name, name);
+	assert(player != NULL);
+	p->player = player;
+	p->loaded_uri = NULL;
+	p->fade = kNoFade;
+	p->tags = NULL;
 
         /* set buffer size */
-        if (buffer_duration > 0) {
+#if GST_CHECK_VERSION(1,10,0)
+        g_signal_connect(G_OBJECT(player), "deep-element-added",
+                         G_CALLBACK(remember_element), p);
+#endif
+        if (buffer_adaptive) {
+                // Start small; grows once we know bitrate and throughput.
+                g_object_set(G_OBJECT(player), "buffer-duration",
+                             (gint64) (buffer_min_seconds * GST_SECOND),
+                             NULL);
+        } else if (buffer_duration > 0) {
                 gint64 buffer_duration_ns = round(buffer_duration * 1.0e9);
                 Log_info("gstreamer",
                          "Setting buffer duration to %" PRId64 "ms",
                          buffer_duration_ns / 1000000);
-                g_object_set(G_OBJECT(player_),
+                g_object_set(G_OBJECT(player),
                              "buffer-duration",
                              buffer_duration_ns,
                              NULL);
@@ -520,15 +3377,13 @@ static int output_gstreamer_init(void)
 			 "Buffering disabled (--gstout-buffer-duration)");
         }
 
-	bus = gst_pipeline_get_bus(GST_PIPELINE(player_));
-	gst_bus_add_watch(bus, my_bus_callback, NULL);
-	gst_object_unref(bus);
+	use_shared_clock(player);
 
-	if (audio_sink != NULL && audio_pipe != NULL) {
-		Log_error("gstreamer", "--gstout-audosink and --gstout-audiopipe are mutually exclusive.");
-		return 1;
-	}
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(player));
+	p->bus_watch = gst_bus_add_watch(bus, my_bus_callback, p);
+	gst_object_unref(bus);
 
+	GstElement *audio = NULL;
 	if (audio_sink != NULL) {
 		GstElement *sink = NULL;
 		Log_info("gstreamer", "Setting audio sink to %s; device=%s\n",
@@ -541,7 +3396,7 @@ static int output_gstreamer_init(void)
 		  if (audio_device != NULL) {
 		    g_object_set (G_OBJECT(sink), "device", audio_device, NULL);
 		  }
-		  g_object_set (G_OBJECT (player_), "audio-sink", sink, NULL);
+		  audio = sink;
 		}
 	}
 	if (audio_pipe != NULL) {
@@ -552,23 +3407,320 @@ static int output_gstreamer_init(void)
 		if (sink == NULL) {
 			Log_error("gstreamer", "Could not create pipeline.");
 		} else {
-			g_object_set (G_OBJECT (player_), "audio-sink", sink, NULL);
+			audio = sink;
 		}
 	}
+	if (output_format != NULL) {
+		audio = create_fixed_format_sink(audio);
+	}
+#if (GST_VERSION_MAJOR >= 1)
+	if (restream_format_ != NULL) {
+		audio = create_restream_sink(p, audio);
+	}
+#endif
+	if (audio != NULL) {
+		g_object_set (G_OBJECT (player), "audio-sink", audio, NULL);
+	}
 	if (videosink != NULL) {
 		GstElement *sink = NULL;
 		Log_info("gstreamer", "Setting video sink to %s", videosink);
 		sink = gst_element_factory_make (videosink, "sink");
-		g_object_set (G_OBJECT (player_), "video-sink", sink, NULL);
+		g_object_set (G_OBJECT (player), "video-sink", sink, NULL);
 	}
 
-	if (gst_element_set_state(player_, GST_STATE_READY) ==
+	if (gst_element_set_state(player, GST_STATE_READY) ==
 	    GST_STATE_CHANGE_FAILURE) {
 		Log_error("gstreamer", "Error: pipeline doesn't become ready.");
 	}
 
-	g_signal_connect(G_OBJECT(player_), "about-to-finish",
+	if (preserve_pitch || crossfade_seconds > 0) {
+		if (g_object_class_find_property(G_OBJECT_GET_CLASS(player),
+						 "audio-filter") == NULL) {
+			Log_error("gstreamer", "This playbin can't preserve pitch "
+				  "or crossfade (no audio-filter).");
+		} else {
+			GstElement *filter = create_audio_filter(p);
+			if (filter != NULL) {
+				g_object_set(G_OBJECT(player), "audio-filter",
+					     filter, NULL);
+			}
+		}
+	}
+
+	g_signal_connect(G_OBJECT(player), "about-to-finish",
 			 G_CALLBACK(prepare_next_stream), NULL);
+#if (GST_VERSION_MAJOR >= 1)
+	g_signal_connect(G_OBJECT(player), "source-setup",
+			 G_CALLBACK(setup_source), NULL);
+#endif
+}
+
+static guint idle_timer_ = 0;
+
+static void ensure_players(void) {
+	if (players_released_) {
+		const gint64 start = g_get_monotonic_time();
+		for (int i = 0; i < pipeline_count; ++i) {
+			gst_element_set_state(pipelines_[i].player,
+					      GST_STATE_READY);
+		}
+		players_released_ = 0;
+		Log_info("gstreamer", "Re-armed %d pipeline(s) in %.1fms",
+			 pipeline_count,
+			 (g_get_monotonic_time() - start) / 1000.0);
+		return;
+	}
+	if (player_ != NULL) {
+		return;
+	}
+	const gint64 start = g_get_monotonic_time();
+	for (int i = 0; i < pipeline_count; ++i) {
+		char name[16];
+		if (i == 0) {
+			strcpy(name, "play");
+		} else {
+			snprintf(name, sizeof(name), "play%d", i);
+		}
+		create_player(&pipelines_[i], name);
+		g_object_set(pipelines_[i].player,
+			     "volume", (double) volume_,
+			     "mute", (gboolean) mute_, NULL);
+	}
+	active_ = &pipelines_[0];
+	player_ = active_->player;
+	Log_info("gstreamer", "Built %d pipeline(s) in %.1fms",
+		 pipeline_count, (g_get_monotonic_time() - start) / 1000.0);
+	arm_idle_timer();  // In case nothing is played.
+}
+
+static void destroy_player(struct pipeline *p) {
+	forget_stream_elements(p);
+	g_source_remove(p->bus_watch);
+	gst_object_unref(p->player);
+	p->player = NULL;
+	free(p->loaded_uri);
+	p->loaded_uri = NULL;
+	forget_tags(&p->tags);
+}
+
+static gboolean release_idle_players(gpointer userdata) {
+	(void)userdata;
+	pthread_mutex_lock(&players_mutex_);
+	idle_timer_ = 0;
+	if (player_ != NULL && !players_released_
+	    && target_state_ == GST_STATE_READY && !transition_pending_
+	    && get_current_player_state() <= GST_STATE_READY) {
+		const gint64 start = g_get_monotonic_time();
+		stop_fade_out();
+		for (int i = 0; i < pipeline_count; ++i) {
+			gst_element_set_state(pipelines_[i].player,
+					      GST_STATE_NULL);
+			if (idle_destroy) {
+				destroy_player(&pipelines_[i]);
+			}
+		}
+		if (idle_destroy) {
+			player_ = NULL;
+		} else {
+			players_released_ = 1;
+		}
+		Log_info("gstreamer", "Idle for %ds; %s pipeline(s) in %.1fms",
+			 idle_seconds, idle_destroy ? "destroyed" : "released",
+			 (g_get_monotonic_time() - start) / 1000.0);
+	}
+	pthread_mutex_unlock(&players_mutex_);
+	return FALSE;
+}
+
+// (Re-)start counting idle time.
+static void arm_idle_timer(void) {
+	if (idle_seconds <= 0) {
+		return;
+	}
+	if (idle_timer_ != 0) {
+		g_source_remove(idle_timer_);
+	}
+	idle_timer_ = g_timeout_add_seconds(idle_seconds,
+					    release_idle_players, NULL);
+}
+
+// All commands that touch the pipelines exclude the idle release.
+static void output_gstreamer_set_uri_locked(const char *uri,
+					    output_update_meta_cb_t meta_cb) {
+	pthread_mutex_lock(&players_mutex_);
+	output_gstreamer_set_uri(uri, meta_cb);
+	pthread_mutex_unlock(&players_mutex_);
+}
+static int output_gstreamer_play_locked(output_transition_cb_t callback) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_play(callback);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_play_at_locked(gint64 clock_time,
+					   output_transition_cb_t callback) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_play_at(clock_time, callback);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_stop_locked(void) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_stop();
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_pause_locked(void) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_pause();
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_seek_locked(gint64 position_nanos) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_seek(position_nanos);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_seek_bytes_locked(gint64 position_bytes) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_seek_bytes(position_bytes);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_set_rate_locked(double rate) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_set_rate(rate);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_get_position_locked(gint64 *track_duration,
+						gint64 *track_pos) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_get_position(track_duration,
+						     track_pos);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_get_volume_locked(float *v) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_get_volume(v);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_set_volume_locked(float value) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_set_volume(value);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_get_mute_locked(int *m) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_get_mute(m);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+static int output_gstreamer_set_mute_locked(int m) {
+	pthread_mutex_lock(&players_mutex_);
+	const int rc = output_gstreamer_set_mute(m);
+	pthread_mutex_unlock(&players_mutex_);
+	return rc;
+}
+
+static int output_gstreamer_init(void)
+{
+	if (seek_strategy != NULL && set_seek_strategy(seek_strategy) != 0) {
+		Log_error("gstreamer", "Unknown --gstout-seek-strategy '%s'. "
+			  "Choose one of accurate, key-unit, snap.",
+			  seek_strategy);
+		return 1;
+	}
+#if (GST_VERSION_MAJOR < 1)
+	if (crossfade_seconds > 0) {
+		Log_error("gstreamer", "Crossfading needs GStreamer 1.x");
+		crossfade_seconds = 0;
+	}
+#endif
+	if (crossfade_seconds > 0 && pipeline_count < 2) {
+		pipeline_count = 2;  // One for each track we fade between.
+	}
+	if (pipeline_count < 1 || pipeline_count > MAX_PIPELINES) {
+		Log_error("gstreamer", "--gstout-pipelines needs to be "
+			  "between 1 and %d", MAX_PIPELINES);
+		return 1;
+	}
+	if (pipeline_count > 1 && audio_device != NULL
+	    && (g_str_has_prefix(audio_device, "hw:")
+		|| g_str_has_prefix(audio_device, "plughw:"))) {
+		Log_error("gstreamer", "Device '%s' can't be opened by more "
+			  "than one pipeline; prerolling will fail. Use a "
+			  "mixing device (e.g. dmix) with --gstout-pipelines",
+			  audio_device);
+	}
+	if (buffer_low_percent < 0 || buffer_low_percent > buffer_high_percent
+	    || buffer_high_percent > 100) {
+		Log_error("gstreamer", "Need 0 <= --gstout-buffer-low-percent "
+			  "<= --gstout-buffer-high-percent <= 100");
+		return 1;
+	}
+	if (buffer_adaptive && (buffer_min_seconds <= 0
+				|| buffer_max_seconds < buffer_min_seconds
+				|| buffer_max_mb <= 0)) {
+		Log_error("gstreamer", "Need 0 < --gstout-buffer-min-seconds "
+			  "<= --gstout-buffer-max-seconds and a positive "
+			  "--gstout-buffer-max-mb");
+		return 1;
+	}
+	if (adaptive_min_kbps < 0 || adaptive_max_kbps < 0
+	    || (adaptive_max_kbps > 0
+		&& adaptive_max_kbps < adaptive_min_kbps)) {
+		Log_error("gstreamer", "--gstout-adaptive-min-kbps needs to be "
+			  "below --gstout-adaptive-max-kbps");
+		return 1;
+	}
+	if (audio_sink != NULL && audio_pipe != NULL) {
+		Log_error("gstreamer", "--gstout-audosink and --gstout-audiopipe are mutually exclusive.");
+		return 1;
+	}
+	if (cache_dir != NULL) {
+#if (GST_VERSION_MAJOR < 1)
+		Log_error("gstreamer", "The media cache needs GStreamer 1.x");
+#else
+		if (MediaCache_init(cache_dir, (int64_t) cache_mb * 1000000)) {
+			return 1;
+		}
+#endif
+	}
+
+	if (setup_shared_clock() != 0) {
+		return 1;
+	}
+	if (restream != NULL) {
+#if (GST_VERSION_MAJOR < 1)
+		Log_error("gstreamer", "Restreaming needs GStreamer 1.x");
+#else
+		if (restream_init() != 0) {
+			return 1;
+		}
+#endif
+	}
+
+	SongMetaData_init(&song_meta_);
+	output_gstreamer_register_mime_types();
+	if (rtp_latency_ms >= 0) {
+		register_rtp_protocols();
+	}
+	// The pipelines are built on first use, see ensure_players(). Until
+	// then, volume and mute are only remembered.
+
+#if (GST_VERSION_MAJOR >= 1)
+	if (crossfade_seconds > 0) {
+		Log_info("gstreamer", "Crossfading %.1fs between tracks",
+			 crossfade_seconds);
+		g_timeout_add(100, crossfade_tick, NULL);
+	}
+#endif
+
 	output_gstreamer_set_mute(0);
 	if (initial_db < 0) {
 		output_gstreamer_set_volume(exp(initial_db / 20 * log(10)));
@@ -583,16 +3735,20 @@ struct output_module gstreamer_output = {
 	.add_options = output_gstreamer_add_options,
 
 	.init        = output_gstreamer_init,
-	.set_uri     = output_gstreamer_set_uri,
+	.set_uri     = output_gstreamer_set_uri_locked,
 	.set_next_uri= output_gstreamer_set_next_uri,
-	.play        = output_gstreamer_play,
-	.stop        = output_gstreamer_stop,
-	.pause       = output_gstreamer_pause,
-	.seek        = output_gstreamer_seek,
-
-	.get_position = output_gstreamer_get_position,
-	.get_volume  = output_gstreamer_get_volume,
-	.set_volume  = output_gstreamer_set_volume,
-	.get_mute  = output_gstreamer_get_mute,
-	.set_mute  = output_gstreamer_set_mute,
+	.play        = output_gstreamer_play_locked,
+	.play_at     = output_gstreamer_play_at_locked,
+	.stop        = output_gstreamer_stop_locked,
+	.pause       = output_gstreamer_pause_locked,
+	.seek        = output_gstreamer_seek_locked,
+	.seek_bytes  = output_gstreamer_seek_bytes_locked,
+	.set_rate    = output_gstreamer_set_rate_locked,
+
+	.get_position = output_gstreamer_get_position_locked,
+	.get_stream_bitrate = output_gstreamer_get_stream_bitrate,
+	.get_volume  = output_gstreamer_get_volume_locked,
+	.set_volume  = output_gstreamer_set_volume_locked,
+	.get_mute  = output_gstreamer_get_mute_locked,
+	.set_mute  = output_gstreamer_set_mute_locked,
 };
@@ -26,4 +26,8 @@
 
 extern struct output_module gstreamer_output;
 
+// Registers the mime types the installed GStreamer plugins can decode;
+// also for other outputs that decode with GStreamer.
+void output_gstreamer_register_mime_types(void);
+
 #endif /*  _OUTPUT_GSTREAMER_H */
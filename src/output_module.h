@@ -36,12 +36,19 @@ struct output_module {
 	void (*set_uri)(const char *uri, output_update_meta_cb_t meta_info);
 	void (*set_next_uri)(const char *uri);
 	int (*play)(output_transition_cb_t transition_callback);
+	int (*play_at)(gint64 clock_time,  // on the shared network clock
+		       output_transition_cb_t transition_callback);
 	int (*stop)(void);
 	int (*pause)(void);
 	int (*seek)(gint64 position_nanos);
+	int (*seek_bytes)(gint64 position_bytes);
+	int (*set_rate)(double rate);  // 1.0: normal speed.
 
 	// parameters
 	int (*get_position)(gint64 *track_duration, gint64 *track_pos);
+	// bits/s of the stream, or the variant of an adaptive stream; 0 if
+	// unknown.
+	int (*get_stream_bitrate)(guint *bitrate);
 	int (*get_volume)(float *);
 	int (*set_volume)(float);
 	int (*get_mute)(int *);
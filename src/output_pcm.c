@@ -0,0 +1,616 @@
+/* output_pcm.c - Output module writing raw PCM to a pipe or file
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+// Decodes with GStreamer, but instead of an audio sink, the samples are
+// written in a fixed format to a named pipe or file descriptor. External
+// DSP or streaming software reads them from there; no loopback sound
+// device in between. The reader sets the pace: the position we report is
+// what it consumed, not what we wrote.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <gst/gst.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "logging.h"
+#include "output_module.h"
+#include "output_gstreamer.h"
+#include "output_pcm.h"
+
+static gchar *pcm_path = NULL;
+static gint pcm_fd = -1;
+static gchar *pcm_format = NULL;
+static const char kDefaultFormat[] = "format=S16LE,rate=44100,channels=2";
+
+static GOptionEntry option_entries[] = {
+        { "pcmout-path", 0, 0, G_OPTION_ARG_STRING, &pcm_path,
+          "Named pipe (created if it doesn't exist) or file to write the "
+          "PCM to.", NULL },
+        { "pcmout-fd", 0, 0, G_OPTION_ARG_INT, &pcm_fd,
+          "Already open file descriptor to write the PCM to, instead of "
+          "--pcmout-path.", NULL },
+        { "pcmout-format", 0, 0, G_OPTION_ARG_STRING, &pcm_format,
+          "Format of the PCM, as raw audio caps fields. Default: "
+          "format=S16LE,rate=44100,channels=2", NULL },
+        { NULL }
+};
+
+#if (GST_VERSION_MAJOR >= 1)
+static GstElement *player_ = NULL;
+static char *uri_ = NULL;       // locally strdup()ed
+static char *next_uri_ = NULL;  // locally strdup()ed
+static int uri_loaded_ = 0;
+static output_transition_cb_t play_trans_callback_ = NULL;
+static int transition_pending_ = 0;
+
+static int fd_ = -1;
+static int can_read_back_ = 0;  // Our own pipe; we can drop what's queued.
+static gint64 bytes_per_second_ = 0;
+
+// Byte accounting. All counts are bytes written to fd_ since we started.
+static pthread_mutex_t mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static gint64 written_ = 0;
+static gint64 track_start_ = 0;        // Where the current track starts,
+static gint64 track_start_nanos_ = 0;  // ... and its position there.
+static gint64 next_track_start_ = -1;  // Gapless next track queued there.
+static int next_track_pending_ = 0;    // About to start the next track.
+static int seek_pending_ = 0;
+static int eos_ = 0;
+static volatile int flushing_ = 0;     // Don't block in write anymore.
+
+// Bytes the reader actually consumed. Expects mutex_ to be held.
+static gint64 consumed_locked(void) {
+	int pending = 0;
+	if (ioctl(fd_, FIONREAD, &pending) != 0) {
+		pending = 0;  // Not a pipe; everything is consumed.
+	}
+	return written_ - pending;
+}
+
+// Drop what the reader has not consumed yet, e.g. after stop or seek.
+// Expects mutex_ to be held.
+static void discard_pending_locked(void) {
+	if (!can_read_back_) {
+		return;
+	}
+	char buf[4096];
+	int pending = 0;
+	while (ioctl(fd_, FIONREAD, &pending) == 0 && pending > 0) {
+		const ssize_t r = read(fd_, buf, sizeof(buf));
+		if (r <= 0) {
+			break;
+		}
+		written_ -= r;
+	}
+}
+
+// Write the iovecs completely, unless we are flushing. The fd is
+// non-blocking, so we never get stuck while the pipeline wants to stop.
+static int write_all(struct iovec *iov, int count) {
+	while (count > 0) {
+		if (flushing_) {
+			return -1;
+		}
+		struct pollfd pfd = { fd_, POLLOUT, 0 };
+		if (poll(&pfd, 1, 100) <= 0) {
+			continue;  // Timeout (check flushing) or EINTR.
+		}
+		const ssize_t w = writev(fd_, iov, count);
+		if (w < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			Log_error("pcm", "Writing PCM failed: %s",
+				  strerror(errno));
+			return -1;
+		}
+		pthread_mutex_lock(&mutex_);
+		written_ += w;
+		pthread_mutex_unlock(&mutex_);
+		size_t done = w;
+		while (count > 0 && done >= iov->iov_len) {
+			done -= iov->iov_len;
+			++iov;
+			--count;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *) iov->iov_base + done;
+			iov->iov_len -= done;
+		}
+	}
+	return 0;
+}
+
+// appsink "new-sample"; streaming thread. Each memory block of the buffer
+// goes out as is with one writev(), so we don't copy to merge them.
+static GstFlowReturn write_sample(GstElement *appsink, gpointer userdata) {
+	(void)userdata;
+	GstSample *sample = NULL;
+	g_signal_emit_by_name(appsink, "pull-sample", &sample);
+	if (sample == NULL) {
+		return GST_FLOW_EOS;
+	}
+	GstBuffer *buffer = gst_sample_get_buffer(sample);
+	const guint n = gst_buffer_n_memory(buffer);
+	GstMapInfo maps[16];
+	struct iovec iov[16];
+	if (n <= 16) {
+		guint mapped = 0;
+		for (; mapped < n; ++mapped) {
+			GstMemory *mem = gst_buffer_peek_memory(buffer,
+								mapped);
+			if (!gst_memory_map(mem, &maps[mapped],
+					    GST_MAP_READ)) {
+				break;
+			}
+			iov[mapped].iov_base = maps[mapped].data;
+			iov[mapped].iov_len = maps[mapped].size;
+		}
+		if (mapped == n) {
+			write_all(iov, n);
+		}
+		for (guint i = 0; i < mapped; ++i) {
+			gst_memory_unmap(gst_buffer_peek_memory(buffer, i),
+					 &maps[i]);
+		}
+	} else if (gst_buffer_map(buffer, &maps[0], GST_MAP_READ)) {
+		iov[0].iov_base = maps[0].data;
+		iov[0].iov_len = maps[0].size;
+		write_all(iov, 1);
+		gst_buffer_unmap(buffer, &maps[0]);
+	}
+	gst_sample_unref(sample);
+	return GST_FLOW_OK;
+}
+
+// Events arriving at the appsink; streaming or seeking thread.
+static GstPadProbeReturn watch_events(GstPad *pad, GstPadProbeInfo *info,
+				      gpointer userdata) {
+	(void)pad;
+	(void)userdata;
+	GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_FLUSH_START:
+		flushing_ = 1;
+		break;
+	case GST_EVENT_FLUSH_STOP:
+		pthread_mutex_lock(&mutex_);
+		discard_pending_locked();
+		if (seek_pending_) {
+			track_start_ = written_;
+			seek_pending_ = 0;
+		}
+		pthread_mutex_unlock(&mutex_);
+		flushing_ = 0;
+		break;
+	case GST_EVENT_STREAM_START:
+		// Everything of the previous track has been written by now.
+		pthread_mutex_lock(&mutex_);
+		if (next_track_pending_) {
+			next_track_start_ = written_;
+			next_track_pending_ = 0;
+		}
+		pthread_mutex_unlock(&mutex_);
+		break;
+	default:
+		break;
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+// Only the reader knows when the next track or the end is audible, so we
+// look at what it consumed regularly. Runs in the main loop.
+static gboolean check_consumed(gpointer userdata) {
+	(void)userdata;
+	pthread_mutex_lock(&mutex_);
+	const gint64 consumed = consumed_locked();
+	const int next_started = (next_track_start_ >= 0
+				  && consumed >= next_track_start_);
+	if (next_started) {
+		track_start_ = next_track_start_;
+		track_start_nanos_ = 0;
+		next_track_start_ = -1;
+	}
+	const int drained = (eos_ && consumed >= written_);
+	if (drained) {
+		eos_ = 0;
+	}
+	pthread_mutex_unlock(&mutex_);
+
+	if (next_started) {
+		free(uri_);
+		uri_ = next_uri_;
+		next_uri_ = NULL;
+		if (play_trans_callback_) {
+			play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+		}
+	}
+	if (drained) {
+		gst_element_set_state(player_, GST_STATE_READY);
+		uri_loaded_ = 0;
+		if (play_trans_callback_) {
+			play_trans_callback_(PLAY_STOPPED);
+		}
+	}
+	return TRUE;
+}
+
+static void finish_pending_transition(void) {
+	if (!transition_pending_) {
+		return;
+	}
+	transition_pending_ = 0;
+	if (play_trans_callback_) {
+		play_trans_callback_(PLAY_TRANSITION_DONE);
+	}
+}
+
+static gboolean bus_callback(GstBus *bus, GstMessage *msg, gpointer data) {
+	(void)bus;
+	(void)data;
+	switch (GST_MESSAGE_TYPE(msg)) {
+	case GST_MESSAGE_EOS:
+		// We report the end once the reader consumed everything.
+		pthread_mutex_lock(&mutex_);
+		eos_ = 1;
+		pthread_mutex_unlock(&mutex_);
+		break;
+
+	case GST_MESSAGE_ERROR: {
+		gchar *debug;
+		GError *err;
+		gst_message_parse_error(msg, &err, &debug);
+		Log_error("pcm", "%s: Error: %s (Debug: %s)",
+			  GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)),
+			  err->message, debug);
+		g_error_free(err);
+		g_free(debug);
+		finish_pending_transition();
+		break;
+	}
+
+	case GST_MESSAGE_ASYNC_DONE:
+		finish_pending_transition();
+		break;
+
+	case GST_MESSAGE_STATE_CHANGED: {
+		GstState oldstate, newstate, pending;
+		gst_message_parse_state_changed(msg, &oldstate, &newstate,
+						&pending);
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(player_)
+		    && newstate == GST_STATE_PLAYING
+		    && pending == GST_STATE_VOID_PENDING) {
+			finish_pending_transition();
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+	return TRUE;
+}
+
+// playbin "about-to-finish"; streaming thread.
+static void prepare_next_stream(GstElement *obj, gpointer userdata) {
+	(void)userdata;
+	if (next_uri_ == NULL) {
+		return;
+	}
+	Log_info("pcm", "about-to-finish; queue %s", next_uri_);
+	pthread_mutex_lock(&mutex_);
+	next_track_pending_ = 1;
+	pthread_mutex_unlock(&mutex_);
+	g_object_set(G_OBJECT(obj), "uri", next_uri_, NULL);
+}
+
+static void output_pcm_set_uri(const char *uri,
+			       output_update_meta_cb_t meta_info) {
+	(void)meta_info;  // Metadata comes with SetAVTransportURI.
+	Log_info("pcm", "Set uri to '%s'", uri);
+	free(uri_);
+	uri_ = (uri && *uri) ? strdup(uri) : NULL;
+	uri_loaded_ = 0;
+}
+
+static void output_pcm_set_next_uri(const char *uri) {
+	Log_info("pcm", "Set next uri to '%s'", uri);
+	free(next_uri_);
+	next_uri_ = (uri && *uri) ? strdup(uri) : NULL;
+}
+
+// Stop writing and drop what the reader didn't get yet.
+static void flush(void) {
+	flushing_ = 1;
+	gst_element_set_state(player_, GST_STATE_READY);
+	flushing_ = 0;
+	pthread_mutex_lock(&mutex_);
+	discard_pending_locked();
+	track_start_ = written_;
+	track_start_nanos_ = 0;
+	next_track_start_ = -1;
+	next_track_pending_ = 0;
+	eos_ = 0;
+	pthread_mutex_unlock(&mutex_);
+}
+
+static int output_pcm_play(output_transition_cb_t callback) {
+	play_trans_callback_ = callback;
+	if (uri_ == NULL) {
+		return -1;
+	}
+	if (!uri_loaded_) {
+		flush();
+		g_object_set(G_OBJECT(player_), "uri", uri_, NULL);
+		uri_loaded_ = 1;
+	}
+	transition_pending_ = 1;
+	if (gst_element_set_state(player_, GST_STATE_PLAYING)
+	    == GST_STATE_CHANGE_FAILURE) {
+		Log_error("pcm", "setting play state failed");
+		transition_pending_ = 0;
+		return -1;
+	}
+	return 0;
+}
+
+static int output_pcm_stop(void) {
+	transition_pending_ = 0;
+	flush();
+	uri_loaded_ = 0;
+	return 0;
+}
+
+static int output_pcm_pause(void) {
+	transition_pending_ = 0;
+	// What is queued in the pipe still plays out.
+	return gst_element_set_state(player_, GST_STATE_PAUSED)
+		== GST_STATE_CHANGE_FAILURE ? -1 : 0;
+}
+
+static int output_pcm_seek(gint64 position_nanos) {
+	pthread_mutex_lock(&mutex_);
+	track_start_nanos_ = position_nanos;
+	seek_pending_ = 1;
+	pthread_mutex_unlock(&mutex_);
+	// Done once the flushing seek prerolled, with its ASYNC_DONE.
+	transition_pending_ = 1;
+	if (!gst_element_seek_simple(player_, GST_FORMAT_TIME,
+				     GST_SEEK_FLAG_FLUSH
+				     | GST_SEEK_FLAG_ACCURATE,
+				     position_nanos)) {
+		transition_pending_ = 0;
+		pthread_mutex_lock(&mutex_);
+		seek_pending_ = 0;
+		pthread_mutex_unlock(&mutex_);
+		return -1;
+	}
+	return 0;
+}
+
+static int output_pcm_get_position(gint64 *track_duration,
+				   gint64 *track_pos) {
+	if (!gst_element_query_duration(player_, GST_FORMAT_TIME,
+					track_duration)) {
+		*track_duration = 0;
+	}
+	pthread_mutex_lock(&mutex_);
+	gint64 bytes = consumed_locked() - track_start_;
+	const gint64 start_nanos = track_start_nanos_;
+	pthread_mutex_unlock(&mutex_);
+	if (bytes < 0) {
+		bytes = 0;  // Still playing out the previous position.
+	}
+	*track_pos = start_nanos + bytes * GST_SECOND / bytes_per_second_;
+	return 0;
+}
+
+static int output_pcm_get_volume(float *v) {
+	double volume;
+	g_object_get(player_, "volume", &volume, NULL);
+	*v = volume;
+	return 0;
+}
+
+static int output_pcm_set_volume(float value) {
+	g_object_set(player_, "volume", (double) value, NULL);
+	return 0;
+}
+
+static int output_pcm_get_mute(int *m) {
+	gboolean val;
+	g_object_get(player_, "mute", &val, NULL);
+	*m = val;
+	return 0;
+}
+
+static int output_pcm_set_mute(int m) {
+	g_object_set(player_, "mute", (gboolean) m, NULL);
+	return 0;
+}
+
+// Bytes per second of the configured format, or 0 if we don't know it.
+static gint64 get_bytes_per_second(const GstCaps *caps) {
+	const GstStructure *s = gst_caps_get_structure(caps, 0);
+	const char *format = gst_structure_get_string(s, "format");
+	gint rate = 0;
+	gint channels = 0;
+	if (format == NULL || !gst_structure_get_int(s, "rate", &rate)
+	    || !gst_structure_get_int(s, "channels", &channels)) {
+		return 0;
+	}
+	// e.g. S16LE, F32LE or S24_32LE; the container width counts.
+	const char *width = strchr(format, '_');
+	width = width ? width + 1 : format + 1;
+	return (gint64) atoi(width) / 8 * rate * channels;
+}
+
+static int open_output(void) {
+	if (pcm_fd >= 0) {
+		fd_ = pcm_fd;
+	} else if (pcm_path != NULL) {
+		struct stat st;
+		if (stat(pcm_path, &st) != 0 && mkfifo(pcm_path, 0644) != 0) {
+			Log_error("pcm", "Can't create pipe %s: %s",
+				  pcm_path, strerror(errno));
+			return -1;
+		}
+		if (stat(pcm_path, &st) == 0 && S_ISFIFO(st.st_mode)) {
+			// Read-write, so we neither wait for a reader to open
+			// it nor fail while there is none.
+			fd_ = open(pcm_path, O_RDWR);
+			can_read_back_ = (fd_ >= 0);
+		} else {
+			fd_ = open(pcm_path, O_WRONLY | O_CREAT | O_TRUNC,
+				   0644);
+		}
+	} else {
+		Log_error("pcm", "Need --pcmout-path or --pcmout-fd");
+		return -1;
+	}
+	if (fd_ < 0) {
+		Log_error("pcm", "Can't open %s: %s", pcm_path,
+			  strerror(errno));
+		return -1;
+	}
+	fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+static int output_pcm_init(void) {
+	gchar *caps_string = g_strdup_printf(
+		"audio/x-raw,%s", pcm_format ? pcm_format : kDefaultFormat);
+	GstCaps *caps = gst_caps_from_string(caps_string);
+	bytes_per_second_ = caps ? get_bytes_per_second(caps) : 0;
+	if (caps != NULL) {
+		gst_caps_unref(caps);
+	}
+	if (bytes_per_second_ <= 0) {
+		Log_error("pcm", "Need format, rate and channels in "
+			  "--pcmout-format; got '%s'", caps_string);
+		g_free(caps_string);
+		return 1;
+	}
+	if (open_output() != 0) {
+		g_free(caps_string);
+		return 1;
+	}
+
+	gchar *description = g_strdup_printf(
+		"audioconvert ! audioresample ! %s "
+		"! appsink name=pcm sync=false emit-signals=true",
+		caps_string);
+	GError *error = NULL;
+	GstElement *sink = gst_parse_bin_from_description(description, TRUE,
+							  &error);
+	g_free(description);
+	if (sink == NULL) {
+		Log_error("pcm", "Can't create PCM sink: %s",
+			  error ? error->message : "?");
+		g_clear_error(&error);
+		g_free(caps_string);
+		return 1;
+	}
+	GstElement *appsink = gst_bin_get_by_name(GST_BIN(sink), "pcm");
+	g_signal_connect(appsink, "new-sample", G_CALLBACK(write_sample),
+			 NULL);
+	GstPad *pad = gst_element_get_static_pad(appsink, "sink");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM
+			  | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+			  watch_events, NULL, NULL);
+	gst_object_unref(pad);
+	gst_object_unref(appsink);
+
+	player_ = gst_element_factory_make("playbin", "play");
+	if (player_ == NULL) {
+		Log_error("pcm", "Can't create playbin");
+		g_free(caps_string);
+		return 1;
+	}
+	g_object_set(G_OBJECT(player_), "audio-sink", sink, "video-sink",
+		     gst_element_factory_make("fakesink", NULL), NULL);
+	GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(player_));
+	gst_bus_add_watch(bus, bus_callback, NULL);
+	gst_object_unref(bus);
+	g_signal_connect(G_OBJECT(player_), "about-to-finish",
+			 G_CALLBACK(prepare_next_stream), NULL);
+	gst_element_set_state(player_, GST_STATE_READY);
+	g_timeout_add(100, check_consumed, NULL);
+	output_gstreamer_register_mime_types();  // Same decoders.
+
+	Log_info("pcm", "Writing %s (%" PRId64 " bytes/s) to %s",
+		 caps_string, bytes_per_second_,
+		 pcm_path ? pcm_path : "file descriptor");
+	g_free(caps_string);
+	return 0;
+}
+#else
+static int output_pcm_init(void) {
+	Log_error("pcm", "The PCM output needs GStreamer 1.x");
+	return 1;
+}
+#endif
+
+static int output_pcm_add_options(GOptionContext *ctx) {
+	GOptionGroup *option_group;
+	option_group = g_option_group_new("pcmout", "PCM Output Options",
+	                                  "Show PCM Output Options",
+	                                  NULL, NULL);
+	g_option_group_add_entries(option_group, option_entries);
+	g_option_context_add_group(ctx, option_group);
+	return 0;
+}
+
+struct output_module pcm_output = {
+        .shortname = "pcm",
+	.description = "Raw PCM to a pipe or file",
+	.add_options = output_pcm_add_options,
+
+	.init        = output_pcm_init,
+#if (GST_VERSION_MAJOR >= 1)
+	.set_uri     = output_pcm_set_uri,
+	.set_next_uri= output_pcm_set_next_uri,
+	.play        = output_pcm_play,
+	.stop        = output_pcm_stop,
+	.pause       = output_pcm_pause,
+	.seek        = output_pcm_seek,
+
+	.get_position = output_pcm_get_position,
+	.get_volume  = output_pcm_get_volume,
+	.set_volume  = output_pcm_set_volume,
+	.get_mute    = output_pcm_get_mute,
+	.set_mute    = output_pcm_set_mute,
+#endif
+};
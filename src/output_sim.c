@@ -0,0 +1,366 @@
+/* output_sim.c - Simulated output module with a virtual clock
+ *
+ * This file is part of GMediaRender.
+ *
+ * GMediaRender is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * GMediaRender is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with GMediaRender; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+ *
+ */
+
+// Plays nothing, but behaves like a player: tracks have a duration, the
+// position advances on a virtual clock, the next uri is picked up shortly
+// before the end (like playbin's about-to-finish) and played gapless, and
+// commands complete after a configurable latency. With a fast virtual
+// clock, the transport and eventing can be tested at thousands of tracks
+// per second, without sound hardware or GStreamer.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "output_module.h"
+#include "output_sim.h"
+#include "upnp_connmgr.h"
+
+static double track_seconds = 180.0;
+static double speed = 1.0;
+static gint latency_ms = 0;
+
+static GOptionEntry option_entries[] = {
+        { "simout-track-seconds", 0, 0, G_OPTION_ARG_DOUBLE, &track_seconds,
+          "Duration of every track, unless the uri says otherwise with "
+          "'duration=SECONDS'. Default 180.", NULL },
+        { "simout-speed", 0, 0, G_OPTION_ARG_DOUBLE, &speed,
+          "Virtual seconds per real second. Default 1.", NULL },
+        { "simout-latency-ms", 0, 0, G_OPTION_ARG_INT, &latency_ms,
+          "Time play and seek take to complete, as do track changes "
+          "that are not gapless.",
+          NULL },
+        { NULL }
+};
+
+// playbin queues the next uri about this long before the end.
+static const gint64 kAboutToFinishNanos = 2000000000LL;
+
+enum sim_state {
+	SIM_STOPPED,
+	SIM_PAUSED,
+	SIM_PLAYING,
+};
+
+static enum sim_state state_ = SIM_STOPPED;
+static char *uri_ = NULL;         // locally strdup()ed
+static char *next_uri_ = NULL;    // locally strdup()ed
+static char *queued_uri_ = NULL;  // Picked up at about-to-finish.
+static int uri_loaded_ = 0;
+static int meta_pending_ = 0;     // Report once we're in the main loop.
+static gint64 duration_ = 0;
+static double rate_ = 1.0;
+static float volume_ = 1.0;
+static int mute_ = 0;
+static struct SongMetaData song_meta_;
+
+// The virtual clock: while playing, the position advances from
+// anchor_position_ at anchor_usec_.
+static gint64 anchor_position_ = 0;
+static gint64 anchor_usec_ = 0;
+
+static guint event_timer_ = 0;       // about-to-finish or end of track.
+static guint transition_timer_ = 0;  // Pending command completes.
+static enum sim_state transition_target_ = SIM_STOPPED;
+static output_transition_cb_t play_trans_callback_ = NULL;
+static output_update_meta_cb_t meta_update_callback_ = NULL;
+
+static gint64 get_virtual_position(void) {
+	gint64 position = anchor_position_;
+	if (state_ == SIM_PLAYING) {
+		position += (g_get_monotonic_time() - anchor_usec_)
+			* 1000 * speed * rate_;
+	}
+	return position < duration_ ? position : duration_;
+}
+
+static void set_virtual_position(gint64 position) {
+	anchor_position_ = position;
+	anchor_usec_ = g_get_monotonic_time();
+}
+
+// Real milliseconds until the virtual clock reaches position.
+static guint real_ms_until(gint64 position) {
+	const double nanos = position - get_virtual_position();
+	return nanos > 0 ? nanos / (1e6 * speed * rate_) : 0;
+}
+
+// Duration from a 'duration=SECONDS' parameter in the uri, or the default.
+static gint64 duration_of(const char *uri) {
+	const char *param = uri ? strstr(uri, "duration=") : NULL;
+	const double seconds = param ? atof(param + strlen("duration="))
+		: track_seconds;
+	return seconds * 1e9;
+}
+
+static void cancel_timer(guint *timer) {
+	if (*timer != 0) {
+		g_source_remove(*timer);
+		*timer = 0;
+	}
+}
+
+static gboolean on_track_event(gpointer userdata);
+
+static void schedule_track_event(void) {
+	cancel_timer(&event_timer_);
+	if (state_ != SIM_PLAYING) {
+		return;
+	}
+	gint64 at = duration_;
+	if (queued_uri_ == NULL && duration_ - kAboutToFinishNanos
+	    > get_virtual_position()) {
+		at = duration_ - kAboutToFinishNanos;
+	}
+	event_timer_ = g_timeout_add(real_ms_until(at), on_track_event, NULL);
+}
+
+// Like tags of a stream, the title is the last part of the uri.
+static void start_track(const char *uri) {
+	duration_ = duration_of(uri);
+	set_virtual_position(0);
+	SongMetaData_clear(&song_meta_);
+	const char *name = strrchr(uri, '/');
+	song_meta_.title = strdup(name ? name + 1 : uri);
+	meta_pending_ = 1;
+}
+
+static void report_meta(void) {
+	if (meta_pending_ && meta_update_callback_ != NULL) {
+		meta_update_callback_(&song_meta_);
+	}
+	meta_pending_ = 0;
+}
+
+static gboolean on_track_event(gpointer userdata) {
+	(void)userdata;
+	event_timer_ = 0;
+	const gint64 position = get_virtual_position();
+	if (position < duration_) {
+		// about-to-finish: whatever is next now, plays gapless.
+		free(queued_uri_);
+		queued_uri_ = next_uri_ ? strdup(next_uri_) : NULL;
+		schedule_track_event();
+		return FALSE;
+	}
+	if (queued_uri_ == NULL && next_uri_ != NULL) {
+		// Came too late for gapless; it loads like a new stream.
+		queued_uri_ = strdup(next_uri_);
+		event_timer_ = g_timeout_add(latency_ms, on_track_event, NULL);
+		return FALSE;
+	}
+	if (queued_uri_ != NULL) {
+		free(uri_);
+		uri_ = queued_uri_;
+		queued_uri_ = NULL;
+		free(next_uri_);
+		next_uri_ = NULL;
+		start_track(uri_);
+		schedule_track_event();
+		if (play_trans_callback_) {
+			play_trans_callback_(PLAY_STARTED_NEXT_STREAM);
+		}
+		report_meta();
+	} else {
+		Log_info("sim", "End of %s", uri_ ? uri_ : "stream");
+		state_ = SIM_STOPPED;
+		uri_loaded_ = 0;
+		set_virtual_position(0);
+		if (play_trans_callback_) {
+			play_trans_callback_(PLAY_STOPPED);
+		}
+	}
+	return FALSE;
+}
+
+static gboolean on_transition_done(gpointer userdata) {
+	(void)userdata;
+	transition_timer_ = 0;
+	const gint64 position = get_virtual_position();
+	state_ = transition_target_;
+	set_virtual_position(position);
+	schedule_track_event();
+	if (play_trans_callback_) {
+		play_trans_callback_(PLAY_TRANSITION_DONE);
+	}
+	report_meta();
+	return FALSE;
+}
+
+// Commands return right away; like a real pipeline, we get to the target
+// state asynchronously, after the configured latency.
+static void start_transition(enum sim_state target) {
+	cancel_timer(&transition_timer_);
+	transition_target_ = target;
+	transition_timer_ = g_timeout_add(latency_ms, on_transition_done, NULL);
+}
+
+static void output_sim_set_uri(const char *uri,
+			       output_update_meta_cb_t meta_info) {
+	// Like the other outputs, we keep playing until asked to play this.
+	free(uri_);
+	uri_ = (uri && *uri) ? strdup(uri) : NULL;
+	uri_loaded_ = 0;
+	meta_update_callback_ = meta_info;
+}
+
+static void output_sim_set_next_uri(const char *uri) {
+	free(next_uri_);
+	next_uri_ = (uri && *uri) ? strdup(uri) : NULL;
+}
+
+static int output_sim_play(output_transition_cb_t callback) {
+	if (uri_ == NULL) {
+		return -1;
+	}
+	play_trans_callback_ = callback;
+	if (!uri_loaded_) {
+		cancel_timer(&event_timer_);
+		free(queued_uri_);
+		queued_uri_ = NULL;
+		state_ = SIM_STOPPED;
+		start_track(uri_);
+		uri_loaded_ = 1;
+	}
+	start_transition(SIM_PLAYING);
+	return 0;
+}
+
+static int output_sim_stop(void) {
+	cancel_timer(&event_timer_);
+	cancel_timer(&transition_timer_);
+	free(queued_uri_);
+	queued_uri_ = NULL;
+	state_ = SIM_STOPPED;
+	uri_loaded_ = 0;
+	set_virtual_position(0);
+	return 0;
+}
+
+static int output_sim_pause(void) {
+	const gint64 position = get_virtual_position();
+	cancel_timer(&event_timer_);
+	cancel_timer(&transition_timer_);
+	state_ = SIM_PAUSED;
+	set_virtual_position(position);
+	return 0;
+}
+
+static int output_sim_seek(gint64 position_nanos) {
+	if (position_nanos < 0 || position_nanos > duration_) {
+		return -1;
+	}
+	const enum sim_state target = (transition_timer_ != 0)
+		? transition_target_ : state_;
+	free(queued_uri_);
+	queued_uri_ = NULL;
+	set_virtual_position(position_nanos);
+	schedule_track_event();
+	start_transition(target == SIM_STOPPED ? SIM_PAUSED : target);
+	return 0;
+}
+
+static int output_sim_set_rate(double rate) {
+	const gint64 position = get_virtual_position();
+	rate_ = rate;
+	set_virtual_position(position);
+	schedule_track_event();
+	return 0;
+}
+
+static int output_sim_get_position(gint64 *track_duration,
+				   gint64 *track_pos) {
+	*track_duration = duration_;
+	*track_pos = get_virtual_position();
+	return 0;
+}
+
+static int output_sim_get_volume(float *v) {
+	*v = volume_;
+	return 0;
+}
+
+static int output_sim_set_volume(float value) {
+	volume_ = value;
+	return 0;
+}
+
+static int output_sim_get_mute(int *m) {
+	*m = mute_;
+	return 0;
+}
+
+static int output_sim_set_mute(int m) {
+	mute_ = m;
+	return 0;
+}
+
+static int output_sim_init(void) {
+	if (speed <= 0 || track_seconds <= 0 || latency_ms < 0) {
+		Log_error("sim", "Need positive --simout-speed and "
+			  "--simout-track-seconds");
+		return 1;
+	}
+	SongMetaData_init(&song_meta_);
+	// We "play" anything, but controllers only send what we announce.
+	register_mime_type("audio/*");
+	register_mime_type("video/*");
+	Log_info("sim", "Simulating %.1fs tracks at %.1fx speed, %dms latency",
+		 track_seconds, speed, latency_ms);
+	return 0;
+}
+
+static int output_sim_add_options(GOptionContext *ctx) {
+	GOptionGroup *option_group;
+	option_group = g_option_group_new("simout", "Simulated Output Options",
+	                                  "Show Simulated Output Options",
+	                                  NULL, NULL);
+	g_option_group_add_entries(option_group, option_entries);
+	g_option_context_add_group(ctx, option_group);
+	return 0;
+}
+
+struct output_module sim_output = {
+        .shortname = "sim",
+	.description = "Simulated player with a virtual clock, for testing",
+	.add_options = output_sim_add_options,
+
+	.init        = output_sim_init,
+	.set_uri     = output_sim_set_uri,
+	.set_next_uri= output_sim_set_next_uri,
+	.play        = output_sim_play,
+	.stop        = output_sim_stop,
+	.pause       = output_sim_pause,
+	.seek        = output_sim_seek,
+	.set_rate    = output_sim_set_rate,
+
+	.get_position = output_sim_get_position,
+	.get_volume  = output_sim_get_volume,
+	.set_volume  = output_sim_set_volume,
+	.get_mute    = output_sim_get_mute,
+	.set_mute    = output_sim_set_mute,
+};
@@ -144,6 +144,7 @@ static const char *direction_values[] = {
 static ithread_mutex_t connmgr_mutex;
 
 static GSList* supported_types_list;
+static GSList* extra_protocol_info_list;
 
 static bool add_mime_type(const char* mime_type)
 {
@@ -246,6 +247,11 @@ void register_mime_type(const char *mime_type) {
 	}
 }
 
+void register_protocol_info(const char *protocol_info) {
+	extra_protocol_info_list = g_slist_append(extra_protocol_info_list,
+						  strdup(protocol_info));
+}
+
 static mime_type_filters_t connmgr_parse_mime_filter_string(const char* filter_string)
 {
 	mime_type_filters_t mime_filter;
@@ -330,6 +336,11 @@ int connmgr_init(const char* mime_filter_string) {
 		Log_info("connmgr", "Registering support for '%s'", (const char*) entry->data);
 		g_string_append_printf(protoInfo, "http-get:*:%s:*,", (const char*) entry->data);
 	}
+	for (GSList* entry = extra_protocol_info_list; entry != NULL; entry = g_slist_next(entry))
+	{
+		Log_info("connmgr", "Registering support for '%s'", (const char*) entry->data);
+		g_string_append_printf(protoInfo, "%s,", (const char*) entry->data);
+	}
 
 	if (protoInfo->len > 0) {
 		// Truncate final comma
@@ -343,6 +354,7 @@ int connmgr_init(const char* mime_filter_string) {
 
 	// Free all lists that were generated
 	g_slist_free_full(supported_types_list, free);
+	g_slist_free_full(extra_protocol_info_list, free);
 	g_slist_free_full(mime_filter.allowed_roots, free);
 	g_slist_free_full(mime_filter.added_types, free);
 	g_slist_free_full(mime_filter.removed_types, free);
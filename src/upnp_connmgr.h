@@ -38,4 +38,8 @@ int connmgr_init(const char* mime_filter);
 
 void register_mime_type(const char *mime_type);
 
+// Register a complete protocol info entry (e.g. "rtsp-rtp-udp:*:*:*") for
+// protocols other than http-get.
+void register_protocol_info(const char *protocol_info);
+
 #endif /* _UPNP_CONNMGR_H */
@@ -128,7 +128,8 @@ void upnp_set_error(struct action_event *event, int error_code,
 		  error_code);
 }
 
-const char *upnp_get_string(struct action_event *event, const char *key)
+const char *upnp_get_optional_string(struct action_event *event,
+				     const char *key)
 {
 	IXML_Node *node;
 
@@ -155,12 +156,19 @@ const char *upnp_get_string(struct action_event *event, const char *key)
 			return node_value != NULL ? node_value : "";
 		}
 	}
-
-	upnp_set_error(event, UPNP_SOAP_E_INVALID_ARGS,
-		       "Missing action request argument (%s)", key);
 	return NULL;
 }
 
+const char *upnp_get_string(struct action_event *event, const char *key)
+{
+	const char *value = upnp_get_optional_string(event, key);
+	if (value == NULL && event->status == 0) {
+		upnp_set_error(event, UPNP_SOAP_E_INVALID_ARGS,
+			       "Missing action request argument (%s)", key);
+	}
+	return value;
+}
+
 static int handle_subscription_request(struct upnp_device *priv,
 				       const UpnpSubscriptionRequest *sr_event)
 {
@@ -239,6 +247,9 @@ int upnp_device_notify(struct upnp_device *device,
                        const char **varnames,
                        const char **varvalues, int varcount)
 {
+	if (device->device_handle < 0) {
+		return 0;  // Nobody can have subscribed yet.
+	}
         UpnpNotify(device->device_handle,
                    device->upnp_device_descriptor->udn, serviceID,
 		   varnames, varvalues, varcount);
@@ -414,13 +425,10 @@ static UPNP_CALLBACK(event_handler, EventType, event, userdata)
 	return 0;
 }
 
-static gboolean initialize_device(struct upnp_device_descriptor *device_def,
-				  struct upnp_device *result_device,
-				  const char *ip_address,
+static gboolean initialize_device(const char *ip_address,
 				  unsigned short port)
 {
 	int rc;
-	char *buf;
 
 	rc = UpnpInit(ip_address, port);
 	/* There have been situations reported in which UPNP had issues
@@ -459,26 +467,6 @@ static gboolean initialize_device(struct upnp_device_descriptor *device_def,
 		return FALSE;
 	}
 
-       	buf = upnp_create_device_desc(device_def);
-	rc = UpnpRegisterRootDevice2(UPNPREG_BUF_DESC,
-				     buf, strlen(buf), 1,
-				     &event_handler, result_device,
-				     &(result_device->device_handle));
-	free(buf);
-
-	if (UPNP_E_SUCCESS != rc) {
-		Log_error("upnp", "UpnpRegisterRootDevice2() Error: %s (%d)",
-			  UpnpGetErrorMessage(rc), rc);
-		return FALSE;
-	}
-
-	rc = UpnpSendAdvertisement(result_device->device_handle, 100);
-	if (UPNP_E_SUCCESS != rc) {
-		Log_error("unpp", "Error sending advertisements: %s (%d)",
-			  UpnpGetErrorMessage(rc), rc);
-		return FALSE;
-	}
-
 	return TRUE;
 }
 
@@ -486,23 +474,16 @@ struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 				     const char *ip_address,
 				     unsigned short port)
 {
-	int rc;
 	char *buf;
 	struct service *srv;
 	struct icon *icon_entry;
 
 	assert(device_def != NULL);
 
-	if (device_def->init_function) {
-		rc = device_def->init_function();
-		if (rc != 0) {
-			return NULL;
-		}
-	}
-
 	struct upnp_device *result_device = (struct upnp_device*)malloc(sizeof(*result_device));
 	result_device->upnp_device_descriptor = device_def;
 	ithread_mutex_init(&(result_device->device_mutex), NULL);
+	result_device->device_handle = -1;  // Not published yet.
 
 	/* register icons in web server */
         for (int i = 0; (icon_entry = device_def->icons[i]); i++) {
@@ -516,7 +497,7 @@ struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 		webserver_register_buf(srv->scpd_url, buf, "text/xml");
 	}
 
-	if (!initialize_device(device_def, result_device, ip_address, port)) {
+	if (!initialize_device(ip_address, port)) {
 		UpnpFinish();
 		free(result_device);
 		return NULL;
@@ -525,6 +506,43 @@ struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 	return result_device;
 }
 
+int upnp_device_publish(struct upnp_device *device)
+{
+	struct upnp_device_descriptor *device_def =
+		device->upnp_device_descriptor;
+	int rc;
+	char *buf;
+
+	if (device_def->init_function) {
+		rc = device_def->init_function();
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+       	buf = upnp_create_device_desc(device_def);
+	rc = UpnpRegisterRootDevice2(UPNPREG_BUF_DESC,
+				     buf, strlen(buf), 1,
+				     &event_handler, device,
+				     &(device->device_handle));
+	free(buf);
+
+	if (UPNP_E_SUCCESS != rc) {
+		Log_error("upnp", "UpnpRegisterRootDevice2() Error: %s (%d)",
+			  UpnpGetErrorMessage(rc), rc);
+		return -1;
+	}
+
+	rc = UpnpSendAdvertisement(device->device_handle, 100);
+	if (UPNP_E_SUCCESS != rc) {
+		Log_error("unpp", "Error sending advertisements: %s (%d)",
+			  UpnpGetErrorMessage(rc), rc);
+		return -1;
+	}
+
+	return 0;
+}
+
 void upnp_device_shutdown(struct upnp_device *device) {
 	UpnpFinish();
 }
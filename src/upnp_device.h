@@ -26,7 +26,7 @@
 
 
 struct upnp_device_descriptor {
-	int (*init_function) (void);
+	int (*init_function) (void);  // Called right before publishing.
         const char *device_type;
         const char *friendly_name;
         const char *manufacturer;
@@ -48,10 +48,16 @@ struct upnp_device_descriptor {
 struct upnp_device;
 struct action_event;
 
+// Starts the UPnP library and web server and provides the service
+// descriptions, but does not make the device known yet.
 struct upnp_device *upnp_device_init(struct upnp_device_descriptor *device_def,
 				     const char *ip_address,
 				     unsigned short port);
 
+// Runs the descriptor's init_function, registers the device and sends
+// the advertisements. Returns 0 on success.
+int upnp_device_publish(struct upnp_device *device);
+
 void upnp_device_shutdown(struct upnp_device *device);
 
 int upnp_add_response(struct action_event *event,
@@ -62,6 +68,10 @@ void upnp_set_error(struct action_event *event, int error_code,
 // Returns a readonly value stored in the action event. Returned value
 // only valid for the life-time of "event".
 const char *upnp_get_string(struct action_event *event, const char *key);
+// Like upnp_get_string(), but returns NULL without setting an error if
+// the argument is not there (some controllers leave out arguments).
+const char *upnp_get_optional_string(struct action_event *event,
+				     const char *key);
 
 // Append variable, identified by the variable number, to the event,
 // store the value under the given parameter name. The caller needs to provide
@@ -117,14 +117,10 @@ void upnp_renderer_dump_transport_scpd(void)
 	fputs(buf, stdout);
 }
 
+// Needs the output to be initialized: this publishes the mime types it
+// registered as SinkProtocolInfo.
 static int upnp_renderer_init(void)
 {
-	static struct service *upnp_services[4];
-	upnp_services[0] = upnp_transport_get_service();
-	upnp_services[1] = upnp_connmgr_get_service();
-	upnp_services[2] = upnp_control_get_service();
-	upnp_services[3] = NULL;
-	render_device.services = upnp_services;
 	return connmgr_init(render_device.mime_filter);
 }
 
@@ -133,6 +129,12 @@ upnp_renderer_descriptor(const char *friendly_name,
 			 const char *uuid,
 			 const char* mime_filter)
 {
+	static struct service *upnp_services[4];
+	upnp_services[0] = upnp_transport_get_service();
+	upnp_services[1] = upnp_connmgr_get_service();
+	upnp_services[2] = upnp_control_get_service();
+	upnp_services[3] = NULL;
+	render_device.services = upnp_services;
 	render_device.friendly_name = friendly_name;
 	render_device.mime_filter = mime_filter;
 
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <assert.h>
 
 #include <glib.h>
@@ -70,6 +71,7 @@ enum {
 	TRANSPORT_CMD_SETAVTRANSPORTURI,
 	TRANSPORT_CMD_STOP,
 	TRANSPORT_CMD_SETNEXTAVTRANSPORTURI,
+	TRANSPORT_CMD_X_PLAYAT,  // vendor extension
 
 	// Not implemented
 	//TRANSPORT_CMD_NEXT,
@@ -180,9 +182,16 @@ static const char *playmodi[] = {
 
 static const char *playspeeds[] = {
 	"1",
+	"1/2",
+	"3/4",
+	"5/4",
+	"3/2",
+	"2",
 	" vendor-defined ",
 	NULL
 };
+// We accept any positive speed up to this, not only the ones listed above.
+static const double kMaxPlaySpeed = 4.0;
 
 static const char *rec_write_stati[] = {
 	"WRITABLE",
@@ -260,6 +269,9 @@ typedef enum {
 	TRANSPORT_VAR_CUR_TRACK_DUR,
 	TRANSPORT_VAR_TRANSPORT_STATE,
 	TRANSPORT_VAR_POS_REC_QUAL_MODE,
+	TRANSPORT_VAR_AAT_CLOCK_TIME,
+	TRANSPORT_VAR_X_BUFFER_UNDERRUNS,
+	TRANSPORT_VAR_X_STREAM_BITRATE,
 	TRANSPORT_VAR_COUNT
 } transport_variable_t;
 
@@ -345,6 +357,11 @@ static struct argument arguments_pause[] = {
 //	{ NULL }
 //};
 
+static struct argument arguments_x_playat[] = {
+        { "InstanceID", PARAM_DIR_IN, TRANSPORT_VAR_AAT_INSTANCE_ID },
+        { "ClockTime", PARAM_DIR_IN, TRANSPORT_VAR_AAT_CLOCK_TIME },
+	{ NULL }
+};
 static struct argument arguments_seek[] = {
         { "InstanceID", PARAM_DIR_IN, TRANSPORT_VAR_AAT_INSTANCE_ID },
         { "Unit", PARAM_DIR_IN, TRANSPORT_VAR_AAT_SEEK_MODE },
@@ -390,6 +407,7 @@ static struct argument *argument_list[] = {
 	[TRANSPORT_CMD_STOP] =                      arguments_stop,
 
 	[TRANSPORT_CMD_SETNEXTAVTRANSPORTURI] =     arguments_setnextavtransporturi,
+	[TRANSPORT_CMD_X_PLAYAT] =                  arguments_x_playat,
 
 	//[TRANSPORT_CMD_RECORD] =                    arguments_record,
 	//[TRANSPORT_CMD_NEXT] =                      arguments_next,
@@ -402,6 +420,10 @@ static struct argument *argument_list[] = {
 
 // Our 'instance' variables.
 static enum transport_state transport_state_ = TRANSPORT_STOPPED;
+// While TRANSITIONING: the state we end up in once the output is done.
+static enum transport_state transition_target_ = TRANSPORT_STOPPED;
+static double play_speed_ = 1.0;  // Numeric TransportPlaySpeed.
+static unsigned int buffer_underruns_ = 0;
 static variable_container_t *state_variables_ = NULL;
 
 /* protects transport_values, and service-specific state */
@@ -522,6 +544,8 @@ static void change_transport_state(enum transport_state new_state) {
 		available_actions = "PLAY,STOP,SEEK";
 		break;
 	case TRANSPORT_TRANSITIONING:
+		available_actions = "PAUSE,STOP,SEEK";
+		break;
 	case TRANSPORT_PAUSED_RECORDING:
 	case TRANSPORT_RECORDING:
 	case TRANSPORT_NO_MEDIA_PRESENT:
@@ -534,6 +558,13 @@ static void change_transport_state(enum transport_state new_state) {
 	}
 }
 
+// Commands to the output return immediately, but take a while to complete.
+// Go into TRANSITIONING until the output tells us it reached "target".
+static void start_transition(enum transport_state target) {
+	transition_target_ = target;
+	change_transport_state(TRANSPORT_TRANSITIONING);
+}
+
 // Callback from our output if the song meta data changed.
 static void update_meta_from_stream(const struct SongMetaData *meta) {
 	if (meta->title == NULL || strlen(meta->title) == 0) {
@@ -565,7 +596,8 @@ static int set_avtransport_uri(struct action_event *event)
 	// Transport URI/Meta set now, current URI/Meta when it starts playing.
 	int requires_meta_update = replace_transport_uri_and_meta(uri, meta);
 
-	if (transport_state_ == TRANSPORT_PLAYING) {
+	if (transport_state_ == TRANSPORT_PLAYING
+	    || transport_state_ == TRANSPORT_TRANSITIONING) {
 		// Uh, wrong state.
 		// Usually, this should not be called while we are PLAYING, only
 		// STOPPED or PAUSED. But if actually some controller sets this
@@ -660,14 +692,46 @@ static void print_upnp_time(char *result, size_t size, gint64 t) {
 	snprintf(result, size, "%d:%02d:%02d", hour, minute, second);
 }
 
+// Parse UPnP time H+:MM:SS[.F+] or H+:MM:SS[.F0/F1] into nanoseconds.
+// Returns -1 if this is not a valid time.
 static gint64 parse_upnp_time(const char *time_string) {
+	const gint64 one_sec_unit = 1000000000LL;
 	int hour = 0;
 	int minute = 0;
 	int second = 0;
-	sscanf(time_string, "%d:%02d:%02d", &hour, &minute, &second);
-	const gint64 seconds = (hour * 3600 + minute * 60 + second);
-	const gint64 one_sec_unit = 1000000000LL;
-	return one_sec_unit * seconds;
+	int consumed = 0;
+	if (sscanf(time_string, "%d:%d:%d%n",
+		   &hour, &minute, &second, &consumed) != 3
+	    || hour < 0 || minute < 0 || minute > 59
+	    || second < 0 || second > 59) {
+		return -1;
+	}
+	gint64 result = one_sec_unit * (hour * 3600LL + minute * 60 + second);
+
+	const char *fraction = time_string + consumed;
+	if (*fraction == '\0') {
+		return result;
+	}
+	if (*fraction++ != '.') {
+		return -1;
+	}
+	int f0 = 0;
+	int f1 = 0;
+	if (sscanf(fraction, "%d/%d%n", &f0, &f1, &consumed) == 2) {
+		if (fraction[consumed] != '\0' || f0 < 0 || f1 <= 0 || f0 >= f1) {
+			return -1;
+		}
+		return result + one_sec_unit * f0 / f1;
+	}
+	if (!isdigit((unsigned char) *fraction)) {
+		return -1;  // "1:00:00." has no fraction at all.
+	}
+	gint64 digit_value = one_sec_unit / 10;
+	for (/**/; isdigit((unsigned char) *fraction); ++fraction) {
+		result += (*fraction - '0') * digit_value;
+		digit_value /= 10;
+	}
+	return (*fraction == '\0') ? result : -1;
 }
 
 // We constantly update the track time to event about it to our clients.
@@ -676,6 +740,7 @@ static void *thread_update_track_time(void *userdata) {
 	const gint64 one_sec_unit = 1000000000LL;
 	char tbuf[32];
 	gint64 last_duration = -1, last_position = -1;
+	guint last_bitrate = 0;
 	for (;;) {
 		usleep(500000);  // 500ms
 		service_lock();
@@ -693,6 +758,13 @@ static void *thread_update_track_time(void *userdata) {
 				last_position = position / one_sec_unit;
 			}
 		}
+		guint bitrate = 0;
+		if (output_get_stream_bitrate(&bitrate) == 0
+		    && bitrate != last_bitrate) {
+			snprintf(tbuf, sizeof(tbuf), "%u", bitrate);
+			replace_var(TRANSPORT_VAR_X_STREAM_BITRATE, tbuf);
+			last_bitrate = bitrate;
+		}
 		service_unlock();
 	}
 	return NULL;  // not reached.
@@ -776,12 +848,95 @@ static void inform_play_transition_from_output(enum PlayFeedback fb) {
 		replace_current_uri_and_meta(av_uri, av_meta);
 		replace_var(TRANSPORT_VAR_NEXT_AV_URI, "");
 		replace_var(TRANSPORT_VAR_NEXT_AV_URI_META, "");
+		// The output tells us once the new stream is audible, so
+		// the time display starts from the beginning now.
+		replace_var(TRANSPORT_VAR_REL_TIME_POS, kZeroTime);
 		break;
 	}
+
+	case PLAY_TRANSITION_DONE:
+		// Might've been stopped or paused in the meantime.
+		if (transport_state_ == TRANSPORT_TRANSITIONING) {
+			change_transport_state(transition_target_);
+		}
+		break;
+
+	case PLAY_BUFFERING: {
+		char count[16];
+		snprintf(count, sizeof(count), "%u", ++buffer_underruns_);
+		replace_var(TRANSPORT_VAR_X_BUFFER_UNDERRUNS, count);
+		// Not playing anymore until the data is back.
+		if (transport_state_ == TRANSPORT_PLAYING) {
+			start_transition(TRANSPORT_PLAYING);
+		}
+		break;
+	}
+
+	case PLAY_BUFFERED:
+		if (transport_state_ == TRANSPORT_TRANSITIONING) {
+			change_transport_state(transition_target_);
+		}
+		break;
 	}
 	service_unlock();
 }
 
+// Start the output playing; right away if clock_time is negative, otherwise
+// once the shared network clock reaches it. Expects the service lock to be
+// held.
+static int start_output_play(struct action_event *event, gint64 clock_time) {
+	const int failed = (clock_time < 0)
+		? output_play(&inform_play_transition_from_output)
+		: output_play_at(clock_time, &inform_play_transition_from_output);
+	if (failed) {
+		upnp_set_error(event, 704, "Playing failed");
+		return -1;
+	}
+	// We only know that playing started once the output reports back.
+	start_transition(TRANSPORT_PLAYING);
+	const char *av_uri = get_var(TRANSPORT_VAR_AV_URI);
+	const char *av_meta = get_var(TRANSPORT_VAR_AV_URI_META);
+	replace_current_uri_and_meta(av_uri, av_meta);
+	return 0;
+}
+
+// Parse TransportPlaySpeed, such as "1", "1/2" or "1.5". Returns a value <= 0
+// if this is not a valid speed.
+static double parse_play_speed(const char *speed) {
+	int numerator = 0;
+	int denominator = 0;
+	int consumed = 0;
+	if (sscanf(speed, "%d/%d%n", &numerator, &denominator, &consumed) == 2
+	    && speed[consumed] == '\0') {
+		return denominator > 0 ? (double) numerator / denominator : -1;
+	}
+	char *end = NULL;
+	const double result = g_ascii_strtod(speed, &end);
+	return (end != speed && *end == '\0') ? result : -1;
+}
+
+// Change to the given play speed, if it differs from the current one.
+// Expects the service lock to be held.
+static int change_play_speed(struct action_event *event, const char *speed) {
+	const double rate = parse_play_speed(speed);
+	if (rate <= 0 || rate > kMaxPlaySpeed) {
+		upnp_set_error(event, UPNP_TRANSPORT_E_PLAYSPEED_NS,
+			       "Play speed '%s' not supported", speed);
+		return -1;
+	}
+	if (rate == play_speed_) {
+		return 0;
+	}
+	if (output_set_rate(rate) != 0) {
+		upnp_set_error(event, UPNP_TRANSPORT_E_PLAYSPEED_NS,
+			       "Can't change play speed to '%s'", speed);
+		return -1;
+	}
+	play_speed_ = rate;
+	replace_var(TRANSPORT_VAR_TRANSPORT_PLAY_SPEED, speed);
+	return 0;
+}
+
 static int play(struct action_event *event)
 {
 	if (!has_instance_id(event)) {
@@ -790,11 +945,36 @@ static int play(struct action_event *event)
 
 	int rc = 0;
 	service_lock();
+	if (transport_state_ == TRANSPORT_NO_MEDIA_PRESENT
+	    || transport_state_ == TRANSPORT_PAUSED_RECORDING
+	    || transport_state_ == TRANSPORT_RECORDING) {
+		/* action not allowed in these states - error 701 */
+		upnp_set_error(event, UPNP_TRANSPORT_E_TRANSITION_NA,
+			       "Transition to PLAY not allowed; allowed=%s",
+			       get_var(TRANSPORT_VAR_CUR_TRANSPORT_ACTIONS));
+		service_unlock();
+		return -1;
+	}
+	// Speed is mandatory, but not all controllers send it. Only
+	// change it once we know the transition is allowed.
+	const char *speed = upnp_get_optional_string(event, "Speed");
+	if (speed != NULL && change_play_speed(event, speed) != 0) {
+		service_unlock();
+		return -1;
+	}
 	switch (transport_state_) {
 	case TRANSPORT_PLAYING:
 		// Nothing to change.
 		break;
 
+	case TRANSPORT_TRANSITIONING:
+		// If we're on the way to PLAYING already, nothing to change.
+		// Otherwise, e.g. while seeking in pause mode, start playing.
+		if (transition_target_ != TRANSPORT_PLAYING) {
+			rc = start_output_play(event, -1);
+		}
+		break;
+
 	case TRANSPORT_STOPPED:
 		// If we were stopped before, we start a new song now. So just
 		// set the time to zero now; otherwise we will see the old
@@ -805,24 +985,55 @@ static int play(struct action_event *event)
 		/* >>> fall through */
 
 	case TRANSPORT_PAUSED_PLAYBACK:
-		if (output_play(&inform_play_transition_from_output)) {
-			upnp_set_error(event, 704, "Playing failed");
-			rc = -1;
-		} else {
-			change_transport_state(TRANSPORT_PLAYING);
-			const char *av_uri = get_var(TRANSPORT_VAR_AV_URI);
-			const char *av_meta = get_var(TRANSPORT_VAR_AV_URI_META);
-			replace_current_uri_and_meta(av_uri, av_meta);
-		}
+		rc = start_output_play(event, -1);
 		break;
 
 	case TRANSPORT_NO_MEDIA_PRESENT:
-	case TRANSPORT_TRANSITIONING:
 	case TRANSPORT_PAUSED_RECORDING:
 	case TRANSPORT_RECORDING:
-		/* action not allowed in these states - error 701 */
+		// Refused above.
+		break;
+	}
+	service_unlock();
+
+	return rc;
+}
+
+// Vendor extension for synchronized playback in several rooms: all
+// renderers get the same ClockTime on the shared network clock
+// (--gstout-net-clock) and start playing exactly then.
+static int play_at(struct action_event *event)
+{
+	if (!has_instance_id(event)) {
+		return -1;
+	}
+	const char *value = upnp_get_string(event, "ClockTime");
+	if (value == NULL) {
+		return -1;
+	}
+	char *end = NULL;
+	const gint64 clock_time = g_ascii_strtoll(value, &end, 10);
+	if (end == value || *end != '\0' || clock_time < 0) {
+		upnp_set_error(event, UPNP_SOAP_E_INVALID_ARGS,
+			       "Invalid ClockTime '%s'", value);
+		return -1;
+	}
+
+	int rc = 0;
+	service_lock();
+	switch (transport_state_) {
+	case TRANSPORT_STOPPED:
+		replace_var(TRANSPORT_VAR_REL_TIME_POS, kZeroTime);
+		/* >>> fall through */
+
+	case TRANSPORT_PAUSED_PLAYBACK:
+		rc = start_output_play(event, clock_time);
+		break;
+
+	default:
+		// Already playing: we can't move in time.
 		upnp_set_error(event, UPNP_TRANSPORT_E_TRANSITION_NA,
-			       "Transition to PLAY not allowed; allowed=%s",
+			       "Synchronized start not allowed; allowed=%s",
 			       get_var(TRANSPORT_VAR_CUR_TRANSPORT_ACTIONS));
 		rc = -1;
 		break;
@@ -846,6 +1057,7 @@ static int pause_stream(struct action_event *event)
 		break;
 
 	case TRANSPORT_PLAYING:
+	case TRANSPORT_TRANSITIONING:
 		if (output_pause()) {
 			upnp_set_error(event, 704, "Pause failed");
 			rc = -1;
@@ -866,6 +1078,40 @@ static int pause_stream(struct action_event *event)
 	return rc;
 }
 
+// Seeking takes some time; stay in TRANSITIONING until the output
+// arrived there.
+static void start_seek_transition(void) {
+	if (transport_state_ == TRANSPORT_PLAYING
+	    || transport_state_ == TRANSPORT_PAUSED_PLAYBACK) {
+		start_transition(transport_state_);
+	}
+}
+
+// Seek to time. Expects the service lock to be held.
+static int seek_time(struct action_event *event, gint64 nanos) {
+	if (output_seek(nanos) != 0) {
+		upnp_set_error(event, UPNP_TRANSPORT_E_ILL_SEEKTARGET,
+			       "Seek failed");
+		return -1;
+	}
+	// Show the target position right away.
+	char tbuf[32];
+	print_upnp_time(tbuf, sizeof(tbuf), nanos);
+	replace_var(TRANSPORT_VAR_REL_TIME_POS, tbuf);
+	start_seek_transition();
+	return 0;
+}
+
+// Parse non-negative decimal number. Returns -1 if invalid.
+static gint64 parse_count(const char *value) {
+	char *end = NULL;
+	const long long result = strtoll(value, &end, 10);
+	if (end == value || *end != '\0' || result < 0) {
+		return -1;
+	}
+	return result;
+}
+
 static int seek(struct action_event *event)
 {
 	if (!has_instance_id(event)) {
@@ -873,22 +1119,53 @@ static int seek(struct action_event *event)
 	}
 
 	const char *unit = upnp_get_string(event, "Unit");
-	if (strcmp(unit, "REL_TIME") == 0) {
-		// This is the only thing we support right now.
-		const char *target = upnp_get_string(event, "Target");
-		gint64 nanos = parse_upnp_time(target);
-		service_lock();
-		if (output_seek(nanos) == 0) {
-			// TODO(hzeller): Seeking might take some time,
-			// pretend to already be there. Should we go into
-			// TRANSITION mode ?
-			// (gstreamer will go into PAUSE, then PLAYING)
-			replace_var(TRANSPORT_VAR_REL_TIME_POS, target);
+	const char *target = upnp_get_string(event, "Target");
+	if (unit == NULL || target == NULL) {
+		return -1;
+	}
+
+	int rc = 0;
+	service_lock();
+	if (strcmp(unit, "REL_TIME") == 0 || strcmp(unit, "ABS_TIME") == 0) {
+		// We only ever have one track, so relative and absolute
+		// times are the same.
+		const gint64 nanos = parse_upnp_time(target);
+		if (nanos < 0) {
+			upnp_set_error(event, UPNP_TRANSPORT_E_ILL_SEEKTARGET,
+				       "Invalid time '%s'", target);
+			rc = -1;
+		} else {
+			rc = seek_time(event, nanos);
 		}
-		service_unlock();
+	} else if (strcmp(unit, "REL_COUNT") == 0
+		   || strcmp(unit, "ABS_COUNT") == 0) {
+		// Our counter is the byte offset in the stream.
+		const gint64 bytes = parse_count(target);
+		if (bytes < 0 || output_seek_bytes(bytes) != 0) {
+			upnp_set_error(event, UPNP_TRANSPORT_E_ILL_SEEKTARGET,
+				       "Can't seek to count '%s'", target);
+			rc = -1;
+		} else {
+			start_seek_transition();
+		}
+	} else if (strcmp(unit, "TRACK_NR") == 0) {
+		// Seeking to the (one and only) track means going to its start.
+		const gint64 track = parse_count(target);
+		if (track < 1 || track > atoi(get_var(TRANSPORT_VAR_NR_TRACKS))) {
+			upnp_set_error(event, UPNP_TRANSPORT_E_ILL_SEEKTARGET,
+				       "No track '%s'", target);
+			rc = -1;
+		} else {
+			rc = seek_time(event, 0);
+		}
+	} else {
+		upnp_set_error(event, UPNP_TRANSPORT_E_SEEKMODE_NS,
+			       "Seek mode '%s' not supported", unit);
+		rc = -1;
 	}
+	service_unlock();
 
-	return 0;
+	return rc;
 }
 
 static struct action transport_actions[] = {
@@ -904,6 +1181,7 @@ static struct action transport_actions[] = {
 	[TRANSPORT_CMD_SETAVTRANSPORTURI] =         {"SetAVTransportURI", set_avtransport_uri},	/* RC9800i */
 	[TRANSPORT_CMD_STOP] =                      {"Stop", stop},
 	[TRANSPORT_CMD_SETNEXTAVTRANSPORTURI] =     {"SetNextAVTransportURI", set_next_avtransport_uri},
+	[TRANSPORT_CMD_X_PLAYAT] =                  {"X_PlayAt", play_at},
 
 	//[TRANSPORT_CMD_RECORD] =                    {"Record", NULL},	/* optional */
 	//[TRANSPORT_CMD_NEXT] =                      {"Next", next},
@@ -991,6 +1269,15 @@ struct service *upnp_transport_get_service(void) {
 		 EV_NO, DATATYPE_UI4, NULL, NULL },
 		{TRANSPORT_VAR_CUR_TRANSPORT_ACTIONS, "CurrentTransportActions", "PLAY",
 		 EV_NO, DATATYPE_STRING, NULL, NULL },
+		// Nanoseconds on the shared network clock; too large for ui4.
+		{TRANSPORT_VAR_AAT_CLOCK_TIME, "A_ARG_TYPE_X_ClockTime", "0",
+		 EV_NO, DATATYPE_STRING, NULL, NULL },
+		// Times playback had to wait for the network since start.
+		{TRANSPORT_VAR_X_BUFFER_UNDERRUNS, "X_BufferUnderruns", "0",
+		 EV_NO, DATATYPE_UI4, NULL, NULL },
+		// bits/s; for HLS/DASH, of the variant chosen. 0: unknown.
+		{TRANSPORT_VAR_X_STREAM_BITRATE, "X_StreamBitrate", "0",
+		 EV_NO, DATATYPE_UI4, NULL, NULL },
 
 		{TRANSPORT_VAR_COUNT, NULL, NULL, EV_NO, DATATYPE_UNKNOWN, NULL, NULL }
 	};
@@ -1020,6 +1307,10 @@ void upnp_transport_init(struct upnp_device *device) {
 					   TRANSPORT_VAR_REL_CTR_POS);
 	UPnPLastChangeCollector_add_ignore(service->last_change,
 					   TRANSPORT_VAR_ABS_CTR_POS);
+	UPnPLastChangeCollector_add_ignore(service->last_change,
+					   TRANSPORT_VAR_X_BUFFER_UNDERRUNS);
+	UPnPLastChangeCollector_add_ignore(service->last_change,
+					   TRANSPORT_VAR_X_STREAM_BITRATE);
 
 	pthread_t thread;
 	pthread_create(&thread, NULL, thread_update_track_time, NULL);
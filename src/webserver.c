@@ -34,6 +34,7 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <upnp.h>
 #include <upnptools.h>  // UpnpGetErrorMessage
@@ -59,6 +60,33 @@ static struct virtual_file {
 	struct virtual_file *next;
 } *virtual_files = NULL;
 
+// Outputs may register files while the device is set up in parallel.
+static pthread_mutex_t virtual_files_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+static void add_virtual_file(struct virtual_file *entry)
+{
+	pthread_mutex_lock(&virtual_files_mutex_);
+	entry->next = virtual_files;
+	virtual_files = entry;
+	pthread_mutex_unlock(&virtual_files_mutex_);
+}
+
+// Entries are never removed nor changed, so they can be used without the
+// lock once found.
+static struct virtual_file *find_virtual_file(const char *filename)
+{
+	struct virtual_file *virtfile;
+
+	pthread_mutex_lock(&virtual_files_mutex_);
+	virtfile = virtual_files;
+	while (virtfile != NULL
+	       && strcmp(filename, virtfile->virtual_fname) != 0) {
+		virtfile = virtfile->next;
+	}
+	pthread_mutex_unlock(&virtual_files_mutex_);
+	return virtfile;
+}
+
 int webserver_register_buf(const char *path, const char *contents,
 			   const char *content_type)
 {
@@ -79,8 +107,7 @@ int webserver_register_buf(const char *path, const char *contents,
 	entry->contents = contents;
 	entry->virtual_fname = path;
 	entry->content_type = content_type;
-	entry->next = virtual_files;
-	virtual_files = entry;
+	add_virtual_file(entry);
 
 	return 0;
 }
@@ -137,30 +164,26 @@ int webserver_register_file(const char *path, const char *content_type)
 	}
 	entry->virtual_fname = path;
 	entry->content_type = content_type;
-	entry->next = virtual_files;
-	virtual_files = entry;
+	add_virtual_file(entry);
 
 	return 0;
 }
 
 static VD_GET_INFO_CALLBACK(webserver_get_info, filename, info, cookie)
 {
-	struct virtual_file *virtfile = virtual_files;
-
-	while (virtfile != NULL) {
-		if (strcmp(filename, virtfile->virtual_fname) == 0) {
-			UpnpFileInfo_set_FileLength(info, virtfile->len);
-			UpnpFileInfo_set_LastModified(info, 0);
-			UpnpFileInfo_set_IsDirectory(info, 0);
-			UpnpFileInfo_set_IsReadable(info, 1);
-			const char *contentType =
-				ixmlCloneDOMString(virtfile->content_type);
-			UpnpFileInfo_set_ContentType(info, (char*) contentType);
-			Log_info("webserver", "Access %s (%s) len=%zd",
-				 filename, contentType, virtfile->len);
-			return 0;
-		}
-		virtfile = virtfile->next;
+	struct virtual_file *virtfile = find_virtual_file(filename);
+
+	if (virtfile != NULL) {
+		UpnpFileInfo_set_FileLength(info, virtfile->len);
+		UpnpFileInfo_set_LastModified(info, 0);
+		UpnpFileInfo_set_IsDirectory(info, 0);
+		UpnpFileInfo_set_IsReadable(info, 1);
+		const char *contentType =
+			ixmlCloneDOMString(virtfile->content_type);
+		UpnpFileInfo_set_ContentType(info, (char*) contentType);
+		Log_info("webserver", "Access %s (%s) len=%zd",
+			 filename, contentType, virtfile->len);
+		return 0;
 	}
 
 	Log_info("webserver", "404 Not found. (attempt to access "
@@ -178,14 +201,13 @@ static VD_OPEN_CALLBACK(webserver_open, filename, mode, cookie)
 		return NULL;
 	}
 
-	for (struct virtual_file *vf = virtual_files; vf; vf = vf->next) {
-		if (strcmp(filename, vf->virtual_fname) == 0) {
-			WebServerFile *file = (WebServerFile*)malloc(sizeof(WebServerFile));
-			file->pos = 0;
-			file->len = vf->len;
-			file->contents = vf->contents;
-			return file;
-		}
+	struct virtual_file *vf = find_virtual_file(filename);
+	if (vf != NULL) {
+		WebServerFile *file = (WebServerFile*)malloc(sizeof(WebServerFile));
+		file->pos = 0;
+		file->len = vf->len;
+		file->contents = vf->contents;
+		return file;
 	}
 
 	return NULL;